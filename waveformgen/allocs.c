@@ -0,0 +1,82 @@
+/*
+ allocs.c
+
+ This file is part of waveformgen.
+ 
+ waveformgen is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ waveformgen is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with waveformgen. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef WFG_DEBUG_ALLOCS
+#include <errno.h>
+#include <stddef.h>
+#include "allocs.h"
+
+/* the allocation functions of the C library are defined here, which the
+   FFmpeg shared libraries resolve to as well as our objects; a linker
+   --wrap would only see the calls of what is linked statically. glibc
+   exports the functions doing the work under these names */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static long allocs;
+
+long wfg_heapAllocs(void)
+{
+    return __atomic_load_n(&allocs, __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t size)
+{
+    __atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    __atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    __atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    __atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED);
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+/* what av_malloc() uses */
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *ptr;
+    
+    if (!alignment || (alignment & (alignment - 1)) || alignment % sizeof(void *))
+        return EINVAL;
+    if (!(ptr = memalign(alignment, size)))
+        return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+#endif
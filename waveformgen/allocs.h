@@ -0,0 +1,31 @@
+/*
+ allocs.h
+
+ This file is part of waveformgen.
+ 
+ waveformgen is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ waveformgen is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with waveformgen. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef WFG_ALLOCS_H
+#define WFG_ALLOCS_H
+
+#ifdef WFG_DEBUG_ALLOCS
+// Heap allocations of the whole process so far, FFmpeg's included: built
+// with -DWFG_DEBUG_ALLOCS, allocs.c counts every malloc, calloc, realloc
+// and aligned allocation. glibc only
+long wfg_heapAllocs(void);
+#endif
+
+#endif
@@ -0,0 +1,749 @@
+/*
+ bench.c
+
+ This file is part of waveformgen.
+
+ waveformgen is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ waveformgen is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with waveformgen. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// wfbench: benchmarks on synthetic inputs generated on the spot, printing
+// one JSON object per measurement to stdout
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+#include "libavfilter/avfilter.h"
+#include "libavfilter/buffersink.h"
+#include "libavfilter/buffersrc.h"
+#include "libavutil/bprint.h"
+#include "libavutil/channel_layout.h"
+#include "libavutil/cpu.h"
+#include "libavutil/opt.h"
+#include "libavutil/time.h"
+#include "waveformgen.h"
+
+enum Signal { SIGNAL_SINE, SIGNAL_NOISE, SIGNAL_SILENCE, SIGNAL_CLIPPED };
+
+static const char *signalNames[] = { "sine", "noise", "silence", "clipped" };
+
+typedef struct CorpusEntry {
+    enum Signal signal;
+    int channels, sampleRate, seconds;
+    const char *extension;      // the container, with its default encoder
+} CorpusEntry;
+
+// the signals on a common file, then layouts, rates, containers and lengths
+static const CorpusEntry corpus[] = {
+    { SIGNAL_SINE,    2, 44100,  60, "mp3"  },
+    { SIGNAL_NOISE,   2, 44100,  60, "mp3"  },
+    { SIGNAL_SILENCE, 2, 44100,  60, "mp3"  },
+    { SIGNAL_CLIPPED, 2, 44100,  60, "mp3"  },
+    { SIGNAL_NOISE,   1, 22050,  60, "mp3"  },
+    { SIGNAL_NOISE,   6, 48000,  60, "flac" },
+    { SIGNAL_NOISE,   2, 44100,  60, "flac" },
+    { SIGNAL_NOISE,   2, 48000,  60, "wav"  },
+    { SIGNAL_NOISE,   2, 48000,  60, "ogg"  },
+    { SIGNAL_NOISE,   2, 44100,   5, "mp3"  },
+    { SIGNAL_NOISE,   2, 44100, 900, "mp3"  },
+};
+
+typedef struct Options {
+    const char *dir;
+    double scale;               // applied to every length
+    int runs;                   // the best of them is reported
+    bool kernels, endToEnd, regenerate;
+} Options;
+
+// xorshift32, so the noise is the same on every machine
+static float noise(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return (int32_t)x / 2147483648.0f;
+}
+
+static double signalValue(enum Signal signal, int64_t i, int channel, int rate,
+                          uint32_t *state)
+{
+    switch (signal) {
+    case SIGNAL_SINE:
+        return 0.5 * sin(2 * M_PI * 440 * (channel + 1) * i / rate);
+    case SIGNAL_NOISE:
+        return 0.5 * noise(state);
+    case SIGNAL_CLIPPED:
+        return av_clipd(2.0 * sin(2 * M_PI * 110 * i / rate), -1.0, 1.0);
+    default:
+        return 0;
+    }
+}
+
+static void storeSample(AVFrame *frame, int channel, int i, double v)
+{
+    int planar = av_sample_fmt_is_planar(frame->format);
+    int index = planar ? i : i * av_frame_get_channels(frame) + channel;
+    uint8_t *data = frame->extended_data[planar ? channel : 0];
+
+    switch (av_get_packed_sample_fmt(frame->format)) {
+    case AV_SAMPLE_FMT_U8:  data[index] = av_clip_uint8(lrint(v * 127) + 128); break;
+    case AV_SAMPLE_FMT_S16: ((int16_t *)data)[index] = av_clip_int16(lrint(v * 32767)); break;
+    case AV_SAMPLE_FMT_S32: ((int32_t *)data)[index] = av_clipl_int32(llrint(v * 2147483647.0)); break;
+    case AV_SAMPLE_FMT_FLT: ((float *)data)[index] = v; break;
+    case AV_SAMPLE_FMT_DBL: ((double *)data)[index] = v; break;
+    default: break;
+    }
+}
+
+// the samples [start, start + frame->nb_samples) of signal
+static void fillFrame(AVFrame *frame, enum Signal signal, int64_t start, uint32_t *state)
+{
+    int channels = av_frame_get_channels(frame), i, c;
+
+    for (i = 0; i < frame->nb_samples; i++)
+        for (c = 0; c < channels; c++)
+            storeSample(frame, c, i, signalValue(signal, start + i, c,
+                                                 frame->sample_rate, state));
+}
+
+static AVFrame *allocFrame(enum AVSampleFormat format, int channels, int rate,
+                           int nbSamples)
+{
+    AVFrame *frame = av_frame_alloc();
+
+    if (!frame)
+        return NULL;
+    frame->format = format;
+    frame->channel_layout = av_get_default_channel_layout(channels);
+    av_frame_set_channels(frame, channels);
+    frame->sample_rate = rate;
+    frame->nb_samples = nbSamples;
+    if (av_frame_get_buffer(frame, 0) < 0)
+        av_frame_free(&frame);
+    return frame;
+}
+
+static int encodeWrite(AVFormatContext *oc, AVFrame *frame, int *gotPacket)
+{
+    AVCodecContext *enc = oc->streams[0]->codec;
+    AVPacket pkt = { .data = NULL, .size = 0 };
+    int ret;
+
+    av_init_packet(&pkt);
+    if ((ret = avcodec_encode_audio2(enc, &pkt, frame, gotPacket)) < 0 || !*gotPacket)
+        return ret;
+    av_packet_rescale_ts(&pkt, enc->time_base, oc->streams[0]->time_base);
+    return av_interleaved_write_frame(oc, &pkt);
+}
+
+// encode entry to path with the container's default encoder
+static int writeCorpusFile(const char *path, const CorpusEntry *entry, int seconds)
+{
+    AVFormatContext *oc = NULL;
+    AVCodecContext *enc;
+    AVCodec *encoder;
+    AVFrame *frame = NULL;
+    uint32_t state = 0x9e3779b9;
+    int64_t total, pos;
+    int ret, gotPacket, frameSize;
+
+    if ((ret = avformat_alloc_output_context2(&oc, NULL, NULL, path)) < 0)
+        return ret;
+    encoder = avcodec_find_encoder(oc->oformat->audio_codec);
+    if (!encoder || !avformat_new_stream(oc, encoder)) {
+        ret = AVERROR_ENCODER_NOT_FOUND;
+        goto end;
+    }
+    enc = oc->streams[0]->codec;
+    enc->sample_fmt = encoder->sample_fmts[0];
+    enc->sample_rate = entry->sampleRate;
+    enc->channels = entry->channels;
+    enc->channel_layout = av_get_default_channel_layout(entry->channels);
+    enc->time_base = (AVRational){1, entry->sampleRate};
+    if (oc->oformat->flags & AVFMT_GLOBALHEADER)
+        enc->flags |= CODEC_FLAG_GLOBAL_HEADER;
+    if ((ret = avcodec_open2(enc, encoder, NULL)) < 0 ||
+        (ret = avio_open(&oc->pb, path, AVIO_FLAG_WRITE)) < 0 ||
+        (ret = avformat_write_header(oc, NULL)) < 0)
+        goto end;
+
+    frameSize = enc->frame_size > 0 ? enc->frame_size : 4096;
+    total = (int64_t)seconds * entry->sampleRate;
+    for (pos = 0; pos < total; pos += frame->nb_samples) {
+        av_frame_free(&frame);
+        frame = allocFrame(enc->sample_fmt, entry->channels, entry->sampleRate,
+                           FFMIN(frameSize, total - pos));
+        if (!frame) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        fillFrame(frame, entry->signal, pos, &state);
+        frame->pts = pos;
+        if ((ret = encodeWrite(oc, frame, &gotPacket)) < 0)
+            goto end;
+    }
+    do {
+        if ((ret = encodeWrite(oc, NULL, &gotPacket)) < 0)
+            goto end;
+    } while (gotPacket && (encoder->capabilities & CODEC_CAP_DELAY));
+    ret = av_write_trailer(oc);
+end:
+    av_frame_free(&frame);
+    if (oc && oc->nb_streams)
+        avcodec_close(oc->streams[0]->codec);
+    if (oc)
+        avio_closep(&oc->pb);
+    avformat_free_context(oc);
+    return ret;
+}
+
+static int64_t bestOf(int64_t best, int64_t start)
+{
+    int64_t t = av_gettime_relative() - start;
+    return best < 0 || t < best ? t : best;
+}
+
+static void printResult(const char *bench, const char *params, double audioSeconds,
+                        int64_t samples, int64_t usec)
+{
+    double wall = FFMAX(usec, 1) / 1e6;
+
+    printf("{\"bench\":\"%s\",%s,\"audio_seconds\":%.3f,\"samples\":%"PRId64","
+           "\"wall_seconds\":%.6f,\"realtime_factor\":%.1f,\"samples_per_sec\":%.0f}\n",
+           bench, params, audioSeconds, samples, wall, audioSeconds / wall, samples / wall);
+    fflush(stdout);
+}
+
+// abuffer -> wf -> abuffersink, the sink taking whatever the source gives
+static int buildGraph(AVFilterGraph *graph, enum AVSampleFormat format, int channels,
+                      int rate, const char *wfArgs, AVFilterContext **src,
+                      AVFilterContext **sink)
+{
+    AVFilterContext *wf;
+    char args[256];
+    int ret;
+
+    snprintf(args, sizeof(args),
+             "time_base=1/%d:sample_rate=%d:sample_fmt=%s:channel_layout=0x%"PRIx64,
+             rate, rate, av_get_sample_fmt_name(format),
+             av_get_default_channel_layout(channels));
+    if ((ret = avfilter_graph_create_filter(src, avfilter_get_by_name("abuffer"), "in",
+                                            args, NULL, graph)) < 0 ||
+        (ret = avfilter_graph_create_filter(&wf, avfilter_get_by_name("wf"), "wf",
+                                            wfArgs, NULL, graph)) < 0 ||
+        (ret = avfilter_graph_create_filter(sink, avfilter_get_by_name("abuffersink"),
+                                            "out", NULL, NULL, graph)) < 0 ||
+        (ret = avfilter_link(*src, 0, wf, 0)) < 0 ||
+        (ret = avfilter_link(wf, 0, *sink, 0)) < 0)
+        return ret;
+    return avfilter_graph_config(graph, NULL);
+}
+
+// the levels of kernels the wf filter picks from, each limited to what
+// the CPU has; the filter's simd option caps AVX-512 too, which forced
+// flags cannot on a libavutil that does not know it
+typedef struct CpuLevel {
+    const char *name;
+    int flags;
+    const char *simd;
+} CpuLevel;
+
+static int cpuLevels(CpuLevel *levels)
+{
+    int detected = av_get_cpu_flags(), nb = 0;
+
+    levels[nb++] = (CpuLevel){ "c", 0, "c" };
+#if defined(__x86_64__) || defined(__i386__)
+    if (detected & AV_CPU_FLAG_SSE2)
+        levels[nb++] = (CpuLevel){ "sse2", detected & (AV_CPU_FLAG_MMX | AV_CPU_FLAG_MMXEXT |
+                                                     AV_CPU_FLAG_SSE | AV_CPU_FLAG_SSE2), "sse2" };
+    if (detected & AV_CPU_FLAG_AVX2)
+        levels[nb++] = (CpuLevel){ "avx2", detected
+#ifdef AV_CPU_FLAG_AVX512
+                                               & ~AV_CPU_FLAG_AVX512
+#endif
+                                 , "avx2" };
+#endif
+    // whatever select_kernels() picks on its own, AVX-512 when present
+    levels[nb++] = (CpuLevel){ "native", -1, "avx512" };
+    return nb;
+}
+
+// per-channel metrics of one base bucket, mirrors WFChannelBucket in af_wf.c
+typedef struct WFChannelBucket {
+    double sum_sq;
+    float min, max;
+} WFChannelBucket;
+
+// the base and per-channel summaries of frames of noise, each channel at
+// its own gain, through the wf filter with metrics and simd
+static int summarize(enum AVSampleFormat format, int channels, const char *simd,
+                     WFBucket **base, int *nbBase, WFChannelBucket **chbase)
+{
+    const int rate = 44100, frameSize = 1000, nbFrames = 20;
+    AVFilterGraph *graph = avfilter_graph_alloc();
+    AVFilterContext *src, *sink, *wf;
+    AVFrame *frame = allocFrame(format, channels, rate, frameSize);
+    AVFrame *out = av_frame_alloc();
+    uint32_t state = 1;
+    uint8_t **value;
+    char wfArgs[80];
+    int f, i, c, len, ret;
+
+    *base = NULL;
+    *chbase = NULL;
+    snprintf(wfArgs, sizeof(wfArgs), "n=4096:w=800:emit=0:metrics=min+max+rms:simd=%s",
+             simd);
+    if (!graph || !frame || !out)
+        ret = AVERROR(ENOMEM);
+    else
+        ret = buildGraph(graph, format, channels, rate, wfArgs, &src, &sink);
+    for (f = 0; f < nbFrames && ret >= 0; f++) {
+        for (i = 0; i < frameSize; i++)
+            for (c = 0; c < channels; c++)
+                storeSample(frame, c, i, noise(&state) / (c + 1));
+        frame->pts = (int64_t)f * frameSize;
+        ret = av_buffersrc_add_frame_flags(src, frame, AV_BUFFERSRC_FLAG_KEEP_REF);
+        while (ret >= 0 && av_buffersink_get_frame(sink, out) >= 0)
+            av_frame_unref(out);
+    }
+    if (ret >= 0)
+        ret = av_buffersrc_add_frame_flags(src, NULL, 0);
+    while (ret >= 0 && av_buffersink_get_frame(sink, out) >= 0)
+        av_frame_unref(out);
+    if (ret >= 0) {
+        wf = avfilter_graph_get_filter(graph, "wf");
+        value = av_opt_ptr(wf->filter->priv_class, wf->priv, "base");
+        len = *(int *)(value + 1);
+        *nbBase = len / sizeof(**base);
+        if (!(*base = av_memdup(*value, len)))
+            ret = AVERROR(ENOMEM);
+        value = av_opt_ptr(wf->filter->priv_class, wf->priv, "chbase");
+        if (ret >= 0 && *(int *)(value + 1) != *nbBase * channels * sizeof(**chbase))
+            ret = AVERROR_BUG;
+        if (ret >= 0 && !(*chbase = av_memdup(*value, *(int *)(value + 1))))
+            ret = AVERROR(ENOMEM);
+    }
+    av_frame_free(&out);
+    av_frame_free(&frame);
+    avfilter_graph_free(&graph);
+    return ret;
+}
+
+static bool sameSum(double a, double b)
+{
+    return fabs(a - b) <= 1e-4 * FFMAX(fabs(a), fabs(b)) + 1e-9;
+}
+
+// the SIMD kernels against the C ones, on packed and planar input: the
+// peaks must be the same, the sums may only differ by their rounding
+static int checkKernels(void)
+{
+    static const enum AVSampleFormat formats[] = {
+        AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_S16P, AV_SAMPLE_FMT_S32, AV_SAMPLE_FMT_S32P,
+        AV_SAMPLE_FMT_FLT, AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_DBL, AV_SAMPLE_FMT_DBLP,
+    };
+    static const int channelCounts[] = { 1, 2, 3, 6 };
+    CpuLevel levels[4];
+    int nbLevels = cpuLevels(levels), f, c, l, i, nbRef, nb, ret = 0;
+
+    for (f = 0; f < FF_ARRAY_ELEMS(formats) && ret >= 0; f++) {
+        for (c = 0; c < FF_ARRAY_ELEMS(channelCounts) && ret >= 0; c++) {
+            int channels = channelCounts[c];
+            WFBucket *ref, *base;
+            WFChannelBucket *chRef, *chbase;
+
+            if ((ret = summarize(formats[f], channels, "c", &ref, &nbRef, &chRef)) < 0) {
+                av_free(ref);
+                av_free(chRef);
+                break;
+            }
+            // the first level is C
+            for (l = 1; l < nbLevels && ret >= 0; l++) {
+                av_force_cpu_flags(levels[l].flags);
+                ret = summarize(formats[f], channels, levels[l].simd, &base, &nb, &chbase);
+                av_force_cpu_flags(-1);
+                if (ret >= 0 && nb != nbRef)
+                    ret = AVERROR_BUG;
+                for (i = 0; i < nbRef && ret >= 0; i++)
+                    if (base[i].min != ref[i].min || base[i].max != ref[i].max ||
+                        !sameSum(base[i].sum_sq, ref[i].sum_sq))
+                        ret = AVERROR_BUG;
+                for (i = 0; i < nbRef * channels && ret >= 0; i++)
+                    if (chbase[i].min != chRef[i].min || chbase[i].max != chRef[i].max ||
+                        !sameSum(chbase[i].sum_sq, chRef[i].sum_sq))
+                        ret = AVERROR_BUG;
+                if (ret == AVERROR_BUG)
+                    fprintf(stderr, "The %s kernels differ from C on %s, %d channels\n",
+                            levels[l].name, av_get_sample_fmt_name(formats[f]), channels);
+                av_free(base);
+                av_free(chbase);
+            }
+            av_free(ref);
+            av_free(chRef);
+        }
+    }
+    return ret;
+}
+
+// the per-sample accumulation of the wf filter on every sample format it
+// takes, fed frames that are already in memory
+static int benchKernels(const Options *opt)
+{
+    static const enum AVSampleFormat formats[] = {
+        AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_S16P, AV_SAMPLE_FMT_S32, AV_SAMPLE_FMT_S32P,
+        AV_SAMPLE_FMT_FLT, AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_DBL, AV_SAMPLE_FMT_DBLP,
+    };
+    static const int channelCounts[] = { 1, 2, 6 };
+    const int rate = 44100, frameSize = 4096;
+    int64_t total = lrint(60 * opt->scale) * rate;
+    CpuLevel levels[4];
+    int nbLevels = cpuLevels(levels), f, c, l, r, ret = 0;
+    char params[256], wfArgs[80];
+
+    for (f = 0; f < FF_ARRAY_ELEMS(formats); f++) {
+        for (c = 0; c < FF_ARRAY_ELEMS(channelCounts); c++) {
+            uint32_t state = 1;
+            AVFrame *frame = allocFrame(formats[f], channelCounts[c], rate, frameSize);
+
+            if (!frame)
+                return AVERROR(ENOMEM);
+            fillFrame(frame, SIGNAL_NOISE, 0, &state);
+            for (l = 0; l < nbLevels; l++) {
+                int64_t best = -1, start, pos;
+
+                av_force_cpu_flags(levels[l].flags);
+                snprintf(wfArgs, sizeof(wfArgs), "n=%"PRId64":w=1800|800:emit=0:simd=%s",
+                         FFMAX(total / 14400, 1), levels[l].simd);
+                for (r = 0; r < opt->runs && ret >= 0; r++) {
+                    AVFilterGraph *graph = avfilter_graph_alloc();
+                    AVFilterContext *src, *sink;
+                    AVFrame *out = av_frame_alloc();
+
+                    if (!graph || !out)
+                        ret = AVERROR(ENOMEM);
+                    else
+                        ret = buildGraph(graph, formats[f], channelCounts[c], rate,
+                                         wfArgs, &src, &sink);
+                    start = av_gettime_relative();
+                    for (pos = 0; pos < total && ret >= 0; pos += frameSize) {
+                        frame->pts = pos;
+                        ret = av_buffersrc_add_frame_flags(src, frame,
+                                                           AV_BUFFERSRC_FLAG_KEEP_REF);
+                        while (ret >= 0 && av_buffersink_get_frame(sink, out) >= 0)
+                            av_frame_unref(out);
+                    }
+                    best = bestOf(best, start);
+                    av_frame_free(&out);
+                    avfilter_graph_free(&graph);
+                }
+                if (ret < 0)
+                    break;
+                snprintf(params, sizeof(params),
+                         "\"format\":\"%s\",\"channels\":%d,\"cpu\":\"%s\"",
+                         av_get_sample_fmt_name(formats[f]), channelCounts[c],
+                         levels[l].name);
+                printResult("kernel", params, (double)total / rate, total, best);
+            }
+            av_force_cpu_flags(-1);
+            av_frame_free(&frame);
+            if (ret < 0)
+                return ret;
+        }
+    }
+    return 0;
+}
+
+// reducing a base summary to the widths, alone: what the wf filter does
+// on its "reduce" command, on a summary handed to it
+static int benchReduction(const Options *opt)
+{
+    static const int sizes[] = { 14400, 1 << 20 };
+    char params[128];
+    int s, r, i, ret = 0;
+
+    for (s = 0; s < FF_ARRAY_ELEMS(sizes); s++) {
+        WFBucket *base = av_malloc_array(sizes[s], sizeof(*base));
+        uint32_t state = 1;
+        int64_t best = -1, start;
+
+        if (!base)
+            return AVERROR(ENOMEM);
+        for (i = 0; i < sizes[s]; i++) {
+            float v = noise(&state);
+            base[i] = (WFBucket){ v * v * 1024, 1024, -fabsf(v), fabsf(v) };
+        }
+        for (r = 0; r < opt->runs && ret >= 0; r++) {
+            AVFilterGraph *graph = avfilter_graph_alloc();
+            AVFilterContext *wf = graph ? avfilter_graph_alloc_filter(graph,
+                                            avfilter_get_by_name("wf"), "reduce") : NULL;
+
+            start = av_gettime_relative();
+            if (!wf)
+                ret = AVERROR(ENOMEM);
+            else if ((ret = av_opt_set_bin(wf, "base", (uint8_t *)base,
+                                           sizes[s] * sizeof(*base),
+                                           AV_OPT_SEARCH_CHILDREN)) >= 0 &&
+                     (ret = avfilter_init_str(wf, "n=1024:w=1800|800:emit=0")) >= 0)
+                ret = avfilter_process_command(wf, "reduce", NULL, NULL, 0, 0);
+            avfilter_graph_free(&graph);
+            best = bestOf(best, start);
+        }
+        av_free(base);
+        if (ret < 0)
+            return ret;
+        snprintf(params, sizeof(params), "\"buckets\":%d,\"widths\":\"1800|800\"", sizes[s]);
+        printResult("reduce", params, sizes[s] * 1024.0 / 44100, sizes[s] * 1024LL, best);
+    }
+    return 0;
+}
+
+// drawing the bitmaps of -I from the results of two widths, alone (no PNG
+// encoding), as images per second
+static int benchRender(const Options *opt)
+{
+    static const char *specs[] = { "1800x280", "[fg=3366cc:fg2=99ccff:bg=ffffff00]800x120" };
+    WfgContext *ctx = wfg_create();
+    int32_t *levels[WFG_MAX_WIDTHS] = { NULL };
+    uint8_t *pixels = NULL;
+    uint32_t state = 1;
+    int i, j, r, ret = 0, iterations = FFMAX(lrint(2000 * opt->scale), 10);
+
+    if (!ctx)
+        return AVERROR(ENOMEM);
+    ctx->nbTypedResults = ctx->nbWidths;
+    for (i = 0; i < ctx->nbTypedResults && ret >= 0; i++) {
+        if (!(levels[i] = av_malloc_array(ctx->widths[i], sizeof(*levels[i])))) {
+            ret = AVERROR(ENOMEM);
+            break;
+        }
+        for (j = 0; j < ctx->widths[i]; j++)
+            levels[i][j] = fabsf(noise(&state)) * ctx->height;
+        ctx->typedResults[i] = (WfgResult){ .index = i, .width = ctx->widths[i],
+                                            .height = ctx->height, .levels = levels[i] };
+    }
+    for (i = 0; i < FF_ARRAY_ELEMS(specs) && ret >= 0; i++) {
+        WfgImage *image;
+        int linesize;
+        int64_t best = -1, start;
+        double wall;
+
+        if ((ret = wfg_addImage(ctx, specs[i])) < 0)
+            break;
+        image = &ctx->images[ctx->nbImages - 1];
+        linesize = FFALIGN(4 * image->width, 32);
+        av_free(pixels);
+        if (!(pixels = av_malloc((size_t)linesize * image->height))) {
+            ret = AVERROR(ENOMEM);
+            break;
+        }
+        for (r = 0; r < opt->runs && ret >= 0; r++) {
+            start = av_gettime_relative();
+            for (j = 0; j < iterations && ret >= 0; j++)
+                ret = wfg_renderImage(ctx, image, pixels, linesize);
+            best = bestOf(best, start);
+        }
+        wall = FFMAX(best, 1) / 1e6;
+        printf("{\"bench\":\"render\",\"width\":%d,\"height\":%d,\"images\":%d,"
+               "\"wall_seconds\":%.6f,\"images_per_sec\":%.0f,\"pixels_per_sec\":%.0f}\n",
+               image->width, image->height, iterations, wall, iterations / wall,
+               (double)iterations * image->width * image->height / wall);
+        fflush(stdout);
+    }
+    av_free(pixels);
+    ctx->nbTypedResults = 0;
+    for (i = 0; i < FF_ARRAY_ELEMS(levels); i++)
+        av_free(levels[i]);
+    wfg_free(&ctx);
+    return ret;
+}
+
+// fraction of the input the approx mode decodes
+#define APPROX_FRACTION 0.05
+
+// largest and mean difference in pixels between two level arrays
+static void levelError(const int32_t *levels, const int32_t *reference, int n,
+                       int *maxError, double *meanError)
+{
+    int i;
+
+    *maxError = 0;
+    *meanError = 0;
+    for (i = 0; i < n; i++) {
+        *maxError = FFMAX(*maxError, abs(levels[i] - reference[i]));
+        *meanError += abs(levels[i] - reference[i]);
+    }
+    if (n)
+        *meanError /= n;
+}
+
+// decode and analyze each corpus file, split in segments, approximated
+// from probes and transcoded to a 128k mp3 in memory, the best of
+// opt->runs each; the segments and the approximation report their error
+// against analyze
+static int benchEndToEnd(const Options *opt)
+{
+    static const char *modes[] = { "analyze", "segments", "approx", "transcode" };
+    WfgContext *ctx = wfg_create();
+    char path[1024], params[1280];
+    int32_t *reference = NULL;
+    struct stat st;
+    int e, m, n, r, ret = 0;
+
+    if (!ctx)
+        return AVERROR(ENOMEM);
+    if (mkdir(opt->dir, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "Could not create '%s'\n", opt->dir);
+        wfg_free(&ctx);
+        return AVERROR(errno);
+    }
+    for (e = 0; e < FF_ARRAY_ELEMS(corpus); e++) {
+        const CorpusEntry *entry = &corpus[e];
+        int seconds = FFMAX(lrint(entry->seconds * opt->scale), 1);
+
+        snprintf(path, sizeof(path), "%s/%s_%dch_%d_%ds.%s", opt->dir,
+                 signalNames[entry->signal], entry->channels, entry->sampleRate,
+                 seconds, entry->extension);
+        if (opt->regenerate || stat(path, &st) < 0) {
+            fprintf(stderr, "generating %s\n", path);
+            if ((ret = writeCorpusFile(path, entry, seconds)) < 0) {
+                // a build without the encoder skips the entry
+                fprintf(stderr, "skipping %s: %s\n", path, av_err2str(ret));
+                unlink(path);
+                ret = 0;
+                continue;
+            }
+        }
+        for (m = 0; m < FF_ARRAY_ELEMS(modes); m++) {
+            int64_t best = -1, start;
+
+            ctx->nbSegments = m == 1 ? FFMAX(sysconf(_SC_NPROCESSORS_ONLN), 2) : 1;
+            ctx->approximate = m == 2 ? APPROX_FRACTION : 0;
+            ctx->nbOutputs = 0;
+            if (m == 3) {
+                ctx->outputs[0] = (WfgOutput){ .format = "mp3", .bitRate = 128000,
+                                               .toMemory = true };
+                ctx->nbOutputs = 1;
+            }
+            for (r = 0; r < opt->runs && ret >= 0; r++) {
+                start = av_gettime_relative();
+                ret = wfg_run(ctx, path, NULL);
+                best = bestOf(best, start);
+            }
+            if (ret < 0)
+                break;
+            n = snprintf(params, sizeof(params),
+                         "\"input\":\"%s\",\"mode\":\"%s\",\"signal\":\"%s\","
+                         "\"channels\":%d,\"sample_rate\":%d,\"container\":\"%s\"", path,
+                         modes[m], signalNames[entry->signal], entry->channels,
+                         ctx->sampleRate, entry->extension);
+            if (m == 0) {
+                av_free(reference);
+                if (!(reference = av_memdup(ctx->typedResults[0].levels,
+                                            ctx->widths[0] * sizeof(*reference)))) {
+                    ret = AVERROR(ENOMEM);
+                    break;
+                }
+            } else if (m == 1 || m == 2) {
+                int maxError;
+                double meanError;
+
+                levelError(ctx->typedResults[0].levels, reference, ctx->widths[0],
+                           &maxError, &meanError);
+                // short inputs fall back to a full decode, a fraction of 1;
+                // the segments differ where a seek landed off their start
+                if (m == 2)
+                    n += snprintf(params + n, sizeof(params) - n,
+                                  ",\"fraction\":%.3f,\"decoded_fraction\":%.3f",
+                                  APPROX_FRACTION,
+                                  (double)ctx->stats.samplesDecoded / FFMAX(ctx->nbSamples, 1));
+                snprintf(params + n, sizeof(params) - n,
+                         ",\"max_error\":%d,\"mean_error\":%.2f", maxError, meanError);
+            }
+            printResult("e2e", params, (double)ctx->nbSamples / ctx->sampleRate,
+                        ctx->nbSamples, best);
+        }
+        // the next entry starts without an output
+        av_freep(&ctx->outputs[0].data);
+        if (ret < 0)
+            break;
+    }
+    av_free(reference);
+    wfg_free(&ctx);
+    return ret;
+}
+
+static void displayHelp(void)
+{
+    printf("usage: wfbench [options] > results.jsonl\n\n\
+           -d dir     corpus directory, generated on first use. Default: bench-corpus\n\
+           -x factor  scale every input length. Default: 1\n\
+           -r runs    report the best of this many runs. Default: 3\n\
+           -k         kernels, checked against C first, reduction and rendering only\n\
+           -e         end to end only\n\
+           -g         regenerate the corpus\n\n\
+           Prints one JSON object per line with realtime_factor (seconds of\n\
+           audio per second) and samples_per_sec (per channel).\n");
+}
+
+int main(int argc, char *argv[])
+{
+    Options opt = { "bench-corpus", 1.0, 3, true, true, false };
+    WfgContext *ctx;
+    int c, ret = 0;
+
+    while ((c = getopt(argc, argv, "d:x:r:kegh")) != -1) {
+        switch (c) {
+        case 'd': opt.dir = optarg; break;
+        case 'x': opt.scale = atof(optarg); break;
+        case 'r': opt.runs = atoi(optarg); break;
+        case 'k': opt.endToEnd = false; break;
+        case 'e': opt.kernels = false; break;
+        case 'g': opt.regenerate = true; break;
+        default:
+            displayHelp();
+            return EXIT_FAILURE;
+        }
+    }
+    if (opt.scale <= 0 || opt.runs < 1) {
+        displayHelp();
+        return EXIT_FAILURE;
+    }
+
+    // registers everything and routes the log as wf does
+    if (!(ctx = wfg_create())) {
+        fprintf(stderr, "Out of memory!\n");
+        return EXIT_FAILURE;
+    }
+    wfg_free(&ctx);
+
+    if (opt.kernels && (ret = checkKernels()) >= 0 &&
+        (ret = benchKernels(&opt)) >= 0 &&
+        (ret = benchReduction(&opt)) >= 0)
+        ret = benchRender(&opt);
+    if (ret >= 0 && opt.endToEnd)
+        ret = benchEndToEnd(&opt);
+    if (ret < 0)
+        fprintf(stderr, "Benchmark failed: %s\n", av_err2str(ret));
+    return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,333 @@
+/*
+ cache.c
+
+ This file is part of waveformgen.
+ 
+ waveformgen is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ waveformgen is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with waveformgen. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include "libavutil/bprint.h"
+#include "libavutil/common.h"
+#include "libavutil/error.h"
+#include "libavutil/file.h"
+#include "libavutil/mem.h"
+#include "libavutil/sha.h"
+#include "cache.h"
+
+// <cacheDir>/<key>.wfc holds a header, the int32 results, the base summary,
+// the size of each output (then of each seek index with seekIndex) and the
+// outputs (then the seek indexes), in the layout of the machine that wrote
+// it; the cache is local.
+#define CACHE_MAGIC "WFGC"
+#define CACHE_VERSION 5
+#define MAX_BLOBS (2 * (WFG_MAX_OUTPUTS + 1))
+
+typedef struct CacheHeader {
+    char magic[4];
+    int32_t version;
+    int32_t resultSize, nbBase, nbOutputs;
+    int32_t duration, samplesPerBase, sampleRate;
+    int64_t nbSamples, estimatedSamples;
+    int32_t hasLoudness;
+    WfgLoudness loudness;
+} CacheHeader;
+
+int wfg_hashFile(const char *path, uint8_t *digest)
+{
+    struct AVSHA *sha = av_sha_alloc();
+    uint8_t *data;
+    size_t size, done;
+    int ret;
+    
+    if (!sha)
+        return AVERROR(ENOMEM);
+    if ((ret = av_file_map(path, &data, &size, 0, NULL)) < 0) {
+        av_free(sha);
+        return ret;
+    }
+    av_sha_init(sha, 256);
+    for (done = 0; done < size; done += FFMIN(size - done, 1 << 30))
+        av_sha_update(sha, data + done, FFMIN(size - done, 1 << 30));
+    av_sha_final(sha, digest);
+    av_file_unmap(data, size);
+    av_free(sha);
+    return 0;
+}
+
+void wfg_cacheKey(const WfgContext *ctx, WfgOutput *const *outputs, int nbOutputs,
+                  const uint8_t *digest, bool byAudio, char *key)
+{
+    struct AVSHA *sha = av_sha_alloc();
+    uint8_t hash[WFG_DIGEST_SIZE];
+    AVBPrint params;
+    const char *ext;
+    int i;
+    
+    av_bprint_init(&params, 0, AV_BPRINT_SIZE_UNLIMITED);
+    av_bprintf(&params, "%s/%d/%c/h=%d/w=", WAVEFORMGEN_VERSION, CACHE_VERSION,
+               byAudio ? 'a' : 'f', ctx->height);
+    for (i = 0; i < ctx->nbWidths; i++)
+        av_bprintf(&params, "%d,", ctx->widths[i]);
+    if (ctx->channelMetrics)
+        av_bprintf(&params, "/m=%d", ctx->channelMetrics);
+    if (ctx->approximate > 0 && ctx->approximate < 1)
+        av_bprintf(&params, "/x=%g", ctx->approximate);
+    if (ctx->measureLoudness)
+        av_bprintf(&params, "/g=%g", ctx->silenceThreshold);
+    if (ctx->seekIndex && nbOutputs)
+        av_bprintf(&params, "/X");
+    // the base is only exported at the zoom resolution with a .wfb file
+    if (ctx->binaryBits)
+        av_bprintf(&params, "/B=%d:Z=%d", ctx->binaryBits, ctx->zoomSamples);
+    for (i = 0; i < nbOutputs; i++) {
+        // without a format the container follows from the name
+        ext = outputs[i]->format ? NULL : strrchr(outputs[i]->path, '.');
+        av_bprintf(&params, "/o=%s:%s:%s:%d:%d:%d", outputs[i]->format ? outputs[i]->format : "",
+                   ext ? ext : "", outputs[i]->codec ? outputs[i]->codec : "",
+                   outputs[i]->bitRate, outputs[i]->sampleRate, outputs[i]->channels);
+    }
+    
+    if (sha && av_bprint_is_complete(&params)) {
+        av_sha_init(sha, 256);
+        av_sha_update(sha, digest, WFG_DIGEST_SIZE);
+        av_sha_update(sha, (const uint8_t *)params.str, params.len);
+        av_sha_final(sha, hash);
+    } else {
+        // out of memory, a key nothing was stored under
+        memset(hash, 0, sizeof(hash));
+    }
+    for (i = 0; i < WFG_DIGEST_SIZE; i++)
+        sprintf(key + 2 * i, "%02x", hash[i]);
+    av_bprint_finalize(&params, NULL);
+    av_free(sha);
+}
+
+typedef struct CacheReader {
+    const uint8_t *p, *end;
+} CacheReader;
+
+static const uint8_t *take(CacheReader *r, int64_t size)
+{
+    const uint8_t *p = r->p;
+    
+    if (size < 0 || size > r->end - r->p)
+        return NULL;
+    r->p += size;
+    return p;
+}
+
+// the file of blob i: an output, or the seek index of output i - nbOutputs
+static char *blobPath(WfgOutput *const *outputs, int nbOutputs, int i)
+{
+    return i < nbOutputs ? av_strdup(outputs[i]->path) :
+                           av_asprintf("%s.idx", outputs[i - nbOutputs]->path);
+}
+
+static int writeFile(const char *path, const uint8_t *data, int64_t size)
+{
+    FILE *f = fopen(path, "wb");
+    int ret = 0;
+    
+    if (!f)
+        return AVERROR(errno);
+    if (fwrite(data, 1, size, f) != size)
+        ret = AVERROR(EIO);
+    if (fclose(f) && !ret)
+        ret = AVERROR(EIO);
+    return ret;
+}
+
+int wfg_cacheLoad(WfgContext *ctx, WfgOutput *const *outputs, int nbOutputs,
+                  const char *key)
+{
+    char *path = av_asprintf("%s/%s.wfc", ctx->cacheDir, key);
+    const CacheHeader *header;
+    const int64_t *sizes;
+    const uint8_t *p;
+    CacheReader r;
+    uint8_t *data = NULL, **dst;
+    char *blob;
+    size_t size = 0;
+    int nbBlobs = nbOutputs * (ctx->seekIndex ? 2 : 1), i, ret = 0;
+    
+    if (!path || av_file_map(path, &data, &size, 0, NULL) < 0)
+        goto end;
+    r.p = data;
+    r.end = data + size;
+    if (!(header = (const CacheHeader *)take(&r, sizeof(*header))) ||
+        memcmp(header->magic, CACHE_MAGIC, 4) || header->version != CACHE_VERSION ||
+        header->nbOutputs != nbOutputs || header->resultSize <= 0 ||
+        header->hasLoudness != ctx->measureLoudness ||
+        header->resultSize % sizeof(*ctx->resultData) ||
+        header->nbBase < 0 || header->sampleRate <= 0)
+        goto end;
+    
+    // checked against the widths when they are delivered
+    if (!(p = take(&r, header->resultSize)) ||
+        !(ctx->resultData = av_memdup(p, header->resultSize)))
+        goto fail;
+    ctx->resultSize = header->resultSize;
+    if (!(p = take(&r, (int64_t)header->nbBase * sizeof(*ctx->base))) ||
+        !(ctx->base = av_memdup(p, FFMAX(header->nbBase, 1) * sizeof(*ctx->base))) ||
+        !(sizes = (const int64_t *)take(&r, nbBlobs * sizeof(*sizes))))
+        goto fail;
+    ctx->nbBase = header->nbBase;
+    for (i = 0; i < nbBlobs; i++) {
+        WfgOutput *out = outputs[i % nbOutputs];
+        
+        if (!(p = take(&r, sizes[i])) || sizes[i] > INT_MAX)
+            goto fail;
+        if (!out->toMemory) {
+            if (!(blob = blobPath(outputs, nbOutputs, i)))
+                goto fail;
+            if ((ret = writeFile(blob, p, sizes[i])) < 0) {
+                fprintf(stderr, "Could not write '%s' from the cache: %s\n",
+                        blob, av_err2str(ret));
+                av_free(blob);
+                goto end;
+            }
+            av_free(blob);
+            continue;
+        }
+        dst = i < nbOutputs ? &out->data : &out->index;
+        if (!(*dst = av_memdup(p, FFMAX(sizes[i], 1))))
+            goto fail;
+        if (i < nbOutputs)
+            out->size = sizes[i];
+        else
+            out->indexSize = sizes[i];
+    }
+    ctx->duration = header->duration;
+    ctx->samplesPerBase = header->samplesPerBase;
+    ctx->sampleRate = header->sampleRate;
+    ctx->nbSamples = header->nbSamples;
+    ctx->estimatedSamples = header->estimatedSamples;
+    ctx->hasLoudness = header->hasLoudness;
+    ctx->loudness = header->loudness;
+    ret = 1;
+    goto end;
+fail:
+    // a truncated entry, or no memory to restore it: recompute
+    fprintf(stderr, "Ignoring the cache entry %s\n", path);
+end:
+    if (data)
+        av_file_unmap(data, size);
+    av_free(path);
+    return ret;
+}
+
+int wfg_cacheLink(const WfgContext *ctx, const char *key, const char *newKey)
+{
+    char *path = av_asprintf("%s/%s.wfc", ctx->cacheDir, key);
+    char *linkPath = av_asprintf("%s/%s.wfc", ctx->cacheDir, newKey);
+    int ret = 0;
+    
+    if (!path || !linkPath)
+        ret = AVERROR(ENOMEM);
+    // replacing what another process stored meanwhile
+    else if (link(path, linkPath) < 0 &&
+             (errno != EEXIST || unlink(linkPath) < 0 || link(path, linkPath) < 0))
+        ret = AVERROR(errno);
+    av_free(path);
+    av_free(linkPath);
+    return ret;
+}
+
+int wfg_cacheStore(const WfgContext *ctx, WfgOutput *const *outputs, int nbOutputs,
+                   const char *const *keys, int nbKeys)
+{
+    uint8_t *maps[MAX_BLOBS] = { NULL };
+    size_t mapSizes[MAX_BLOBS] = { 0 };
+    int64_t sizes[MAX_BLOBS];
+    CacheHeader header = {
+        .magic            = CACHE_MAGIC,
+        .version          = CACHE_VERSION,
+        .resultSize       = ctx->resultSize,
+        .nbBase           = ctx->nbBase,
+        .nbOutputs        = nbOutputs,
+        .duration         = ctx->duration,
+        .samplesPerBase   = ctx->samplesPerBase,
+        .sampleRate       = ctx->sampleRate,
+        .nbSamples        = ctx->nbSamples,
+        .estimatedSamples = ctx->estimatedSamples,
+        .hasLoudness      = ctx->hasLoudness,
+        .loudness         = ctx->loudness,
+    };
+    char *path = NULL, *tmp = NULL, *blob;
+    FILE *f = NULL;
+    int nbBlobs = nbOutputs * (ctx->seekIndex ? 2 : 1), i, fd, ret = 0;
+    
+    if (ctx->nbTypedResults != ctx->nbWidths || nbOutputs > WFG_MAX_OUTPUTS + 1)
+        return AVERROR(EINVAL);
+    for (i = 0; i < nbBlobs; i++) {
+        if (outputs[i % nbOutputs]->toMemory) {
+            sizes[i] = i < nbOutputs ? outputs[i]->size : outputs[i - nbOutputs]->indexSize;
+            continue;
+        }
+        if (!(blob = blobPath(outputs, nbOutputs, i))) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        ret = av_file_map(blob, &maps[i], &mapSizes[i], 0, NULL);
+        av_free(blob);
+        if (ret < 0)
+            goto end;
+        sizes[i] = mapSizes[i];
+    }
+    
+    path = av_asprintf("%s/%s.wfc", ctx->cacheDir, keys[0]);
+    tmp = av_asprintf("%s/.%s.XXXXXX", ctx->cacheDir, keys[0]);
+    if (!path || !tmp) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    if ((fd = mkstemp(tmp)) < 0 || !(f = fdopen(fd, "wb"))) {
+        ret = AVERROR(errno);
+        if (fd >= 0)
+            close(fd);
+        goto end;
+    }
+    fwrite(&header, sizeof(header), 1, f);
+    fwrite(ctx->resultData, 1, ctx->resultSize, f);
+    fwrite(ctx->base, sizeof(*ctx->base), ctx->nbBase, f);
+    fwrite(sizes, sizeof(*sizes), nbBlobs, f);
+    for (i = 0; i < nbBlobs; i++)
+        fwrite(maps[i] ? maps[i] : i < nbOutputs ? outputs[i]->data :
+               outputs[i - nbOutputs]->index, 1, sizes[i], f);
+    if (ferror(f) | fclose(f)) {
+        ret = AVERROR(EIO);
+        unlink(tmp);
+        goto end;
+    }
+    if (rename(tmp, path) < 0) {
+        ret = AVERROR(errno);
+        unlink(tmp);
+        goto end;
+    }
+    // the same entry under the other keys
+    for (i = 1; i < nbKeys; i++)
+        wfg_cacheLink(ctx, keys[0], keys[i]);
+end:
+    for (i = 0; i < nbBlobs; i++)
+        if (maps[i])
+            av_file_unmap(maps[i], mapSizes[i]);
+    av_free(path);
+    av_free(tmp);
+    return ret;
+}
@@ -0,0 +1,53 @@
+/*
+ cache.h
+
+ This file is part of waveformgen.
+ 
+ waveformgen is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ waveformgen is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with waveformgen. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef WFG_CACHE_H
+#define WFG_CACHE_H
+
+#include "waveformgen.h"
+
+#define WFG_DIGEST_SIZE 32          // SHA-256
+#define WFG_CACHE_KEY_SIZE 65       // in hex, with the terminating 0
+
+// SHA-256 of the bytes of a file, or AVERROR
+int wfg_hashFile(const char *path, uint8_t *digest);
+
+// Key of a job's results in ctx->cacheDir: the digest of its input, byAudio
+// telling whether that is of the file or its decoded samples, and every
+// parameter the results depend on, the outputs included.
+void wfg_cacheKey(const WfgContext *ctx, WfgOutput *const *outputs, int nbOutputs,
+                  const uint8_t *digest, bool byAudio, char *key);
+
+// Restore the results stored under key into ctx and write the encoded
+// outputs from it. 1 on a hit, 0 when there is none (or it is unreadable),
+// AVERROR when an output could not be written.
+int wfg_cacheLoad(WfgContext *ctx, WfgOutput *const *outputs, int nbOutputs,
+                  const char *key);
+
+// Make the entry stored under key also the one of newKey, without copying.
+int wfg_cacheLink(const WfgContext *ctx, const char *key, const char *newKey);
+
+// Store the results of the last run under each of the keys. Encoded files
+// are read back from their paths. Written to a temporary file and renamed,
+// so concurrent jobs and processes never see a partial entry.
+int wfg_cacheStore(const WfgContext *ctx, WfgOutput *const *outputs, int nbOutputs,
+                   const char *const *keys, int nbKeys);
+
+#endif
@@ -0,0 +1,212 @@
+/*
+ live.c
+
+ This file is part of waveformgen.
+ 
+ waveformgen is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ waveformgen is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with waveformgen. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+#include "libavutil/avstring.h"
+#include "libavutil/common.h"
+#include "libavutil/error.h"
+#include "libavutil/mem.h"
+#include "live.h"
+#include "results.h"
+
+int wfg_setLive(WfgContext *ctx, const char *spec)
+{
+    char *copy, *opts = NULL, *ms, *key, *value, *end, *saveptr = NULL;
+    int ret = 0;
+    
+    if (!(copy = av_strdup(spec)))
+        return AVERROR(ENOMEM);
+    ctx->liveChunk = 1000;
+    ctx->liveLevels = 8;
+    ms = copy;
+    if (*ms == '[') {
+        if (!(end = strchr(ms, ']'))) {
+            ret = AVERROR(EINVAL);
+            goto end;
+        }
+        *end = 0;
+        opts = ms + 1;
+        ms = end + 1;
+    }
+    for (key = opts ? strtok_r(opts, ":", &saveptr) : NULL; key && ret >= 0;
+         key = strtok_r(NULL, ":", &saveptr)) {
+        if (!(value = strchr(key, '='))) {
+            ret = AVERROR(EINVAL);
+            break;
+        }
+        *value++ = 0;
+        if (!strcmp(key, "c")) {
+            ctx->liveChunk = atoi(value);
+        } else if (!strcmp(key, "l")) {
+            ctx->liveLevels = atoi(value);
+        } else {
+            fprintf(stderr, "Unknown live option '%s'\n", key);
+            ret = AVERROR(EINVAL);
+        }
+    }
+    if (ret >= 0 && ((ctx->liveMs = atoi(ms)) <= 0 || ctx->liveChunk <= 0 ||
+                     ctx->liveLevels < 1 || ctx->liveLevels > WFG_MAX_LIVE_LEVELS))
+        ret = AVERROR(EINVAL);
+end:
+    if (ret < 0) {
+        fprintf(stderr, "Invalid live mode '%s'\n", spec);
+        ctx->liveMs = 0;
+    }
+    av_free(copy);
+    return ret;
+}
+
+int wfg_liveOpen(WfgLive *live, const WfgContext *ctx, const char *name,
+                 int samplesPerBucket, int sampleRate)
+{
+    char *path;
+    
+    memset(live, 0, sizeof(*live));
+    live->height = ctx->height;
+    live->nbLevels = ctx->liveLevels;
+    if (ctx->jsonToStdout) {
+        live->out = stdout;
+    } else {
+        if (!(path = av_asprintf("%s_live.jsonl", name)))
+            return AVERROR(ENOMEM);
+        if (!(live->out = fopen(path, "w"))) {
+            fprintf(stderr, "Could not open '%s'\n", path);
+            av_free(path);
+            return AVERROR(errno);
+        }
+        av_free(path);
+        live->ownsOut = true;
+    }
+    fprintf(live->out, "{\"ms\":%d,\"samples_per_bucket\":%d,\"sample_rate\":%d,"
+            "\"height\":%d,\"levels\":%d}\n", ctx->liveMs, samplesPerBucket, sampleRate,
+            live->height, live->nbLevels);
+    return fflush(live->out) ? AVERROR(errno) : 0;
+}
+
+// one line of nb buckets of a level, their first being its bucket start;
+// the values are written like the JSON results, without printf
+static int writeLine(WfgLive *live, int level, int64_t start, const WFBucket *b, int nb)
+{
+    char *p;
+    int i, ret;
+    
+    if (nb > live->lineSize) {
+        if ((ret = av_reallocp_array(&live->values, nb, sizeof(*live->values))) < 0 ||
+            (ret = av_reallocp(&live->line, 64 + 3 * 14 * (size_t)nb)) < 0) {
+            live->lineSize = 0;
+            return ret;
+        }
+        live->lineSize = nb;
+    }
+    p = live->line + sprintf(live->line, "{\"level\":%d,\"start\":%"PRId64",\"min\":[",
+                             level, start);
+    for (i = 0; i < nb; i++)
+        live->values[i] = lrint(av_clipf(b[i].min, -1, 1) * live->height);
+    p = wfg_writeInts(p, live->values, nb);
+    memcpy(p, "],\"max\":[", 9);
+    for (i = 0; i < nb; i++)
+        live->values[i] = lrint(av_clipf(b[i].max, -1, 1) * live->height);
+    p = wfg_writeInts(p + 9, live->values, nb);
+    memcpy(p, "],\"rms\":[", 9);
+    for (i = 0; i < nb; i++)
+        live->values[i] = b[i].nb ? lrint(sqrt(b[i].sum_sq / b[i].nb) * live->height) : 0;
+    p = wfg_writeInts(p + 9, live->values, nb);
+    memcpy(p, "]}\n", 3);
+    return fwrite(live->line, 1, p + 3 - live->line, live->out) == p + 3 - live->line ?
+           0 : AVERROR(EIO);
+}
+
+int wfg_liveWrite(WfgLive *live, const WFBucket *buckets, int nb)
+{
+    const WFBucket *src = buckets;
+    WFBucket *dst;
+    int k, i, m, ret;
+    
+    if (nb > live->scratchSize) {
+        for (i = 0; i < 2; i++)
+            if ((ret = av_reallocp_array(&live->scratch[i], nb, sizeof(*dst))) < 0) {
+                live->scratchSize = 0;
+                return ret;
+            }
+        live->scratchSize = nb;
+    }
+    for (k = 0; k < live->nbLevels && nb; k++) {
+        if ((ret = writeLine(live, k, live->next[k], src, nb)) < 0)
+            return ret;
+        live->next[k] += nb;
+        if (k + 1 == live->nbLevels)
+            break;
+        // pair the buckets into the next level, the odd one out waits
+        dst = live->scratch[k & 1];
+        for (i = m = 0; i < nb; i++) {
+            if (live->hasPending[k + 1]) {
+                dst[m] = live->pending[k + 1];
+                wfg_mergeBucket(&dst[m++], &src[i]);
+                live->hasPending[k + 1] = false;
+            } else {
+                live->pending[k + 1] = src[i];
+                live->hasPending[k + 1] = true;
+            }
+        }
+        src = dst;
+        nb = m;
+    }
+    return fflush(live->out) ? AVERROR(errno) : 0;
+}
+
+int wfg_liveClose(WfgLive *live, int64_t samples, int sampleRate, int ret)
+{
+    WFBucket carry;
+    bool hasCarry = false;
+    int k;
+    
+    if (!live->out)
+        return ret;
+    if (ret >= 0) {
+        // what the stream ended in the middle of, at each coarser level
+        for (k = 1; k < live->nbLevels; k++) {
+            if (live->hasPending[k]) {
+                if (hasCarry)
+                    wfg_mergeBucket(&live->pending[k], &carry);
+                carry = live->pending[k];
+                hasCarry = true;
+            }
+            if (hasCarry && (ret = writeLine(live, k, live->next[k]++, &carry, 1)) < 0)
+                break;
+        }
+        if (ret >= 0)
+            fprintf(live->out, "{\"end\":true,\"samples\":%"PRId64",\"duration\":%"PRId64"}\n",
+                    samples, sampleRate > 0 ? samples * 1000 / sampleRate : 0);
+    }
+    if (ferror(live->out) && ret >= 0)
+        ret = AVERROR(EIO);
+    if (live->ownsOut ? fclose(live->out) : fflush(live->out))
+        ret = ret < 0 ? ret : AVERROR(errno);
+    live->out = NULL;
+    av_freep(&live->scratch[0]);
+    av_freep(&live->scratch[1]);
+    live->scratchSize = 0;
+    av_freep(&live->values);
+    av_freep(&live->line);
+    live->lineSize = 0;
+    return ret;
+}
@@ -0,0 +1,54 @@
+/*
+ live.h
+
+ This file is part of waveformgen.
+ 
+ waveformgen is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ waveformgen is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with waveformgen. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef WFG_LIVE_H
+#define WFG_LIVE_H
+
+#include "waveformgen.h"
+
+// The rolling output of a live run: JSON lines appended as the buckets of
+// liveMs arrive, level 0 holding them as they are and each further level
+// pairs of the one before. Only the unpaired bucket of each level is kept,
+// so the memory does not grow with the stream.
+typedef struct WfgLive {
+    FILE *out;
+    bool ownsOut;                   // a file of ours, not stdout
+    int height, nbLevels;
+    int64_t next[WFG_MAX_LIVE_LEVELS];      // index of each level's next bucket
+    WFBucket pending[WFG_MAX_LIVE_LEVELS];  // first of a pair, when hasPending
+    bool hasPending[WFG_MAX_LIVE_LEVELS];
+    WFBucket *scratch[2];           // the pairs of a chunk, level by level
+    int scratchSize;
+    int32_t *values;                // one array of a line, scaled
+    char *line;                     // the text of a line
+    int lineSize;                   // in buckets, of both
+} WfgLive;
+
+// start <name>_live.jsonl, or stdout with jsonToStdout, with a line giving
+// the resolution: samplesPerBucket at sampleRate
+int wfg_liveOpen(WfgLive *live, const WfgContext *ctx, const char *name,
+                 int samplesPerBucket, int sampleRate);
+// append the closed buckets of one chunk at every level they complete
+int wfg_liveWrite(WfgLive *live, const WFBucket *buckets, int nb);
+// end with the unpaired buckets and a line of the totals, or only close
+// after an error
+int wfg_liveClose(WfgLive *live, int64_t samples, int sampleRate, int ret);
+
+#endif
@@ -20,8 +20,16 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <unistd.h>
 #include "waveformgen.h"
+#include "server.h"
+#include "pool.h"
 
 
 #define PRINT_VERSION printf("waveformgen v%s - a waveform image generator\n\n",WAVEFORMGEN_VERSION);
@@ -41,48 +49,296 @@ static int get_filename_ext(char *filename, char *exten)
     return 0;
 }
 
-int main (int argc, char *argv[])
+// without -p: the percentage and at the end the duration in ms, bare
+// numbers on stdout as before there were events
+static void printProgress(void *opaque, const WfgEvent *event)
 {
-    char* inFile = NULL;
-    char* mFile = NULL;
+    if(event->type == WFG_EVENT_PROGRESS && event->percent >= 0)
+        printf("%d\n", event->percent);
+    else if(event->type == WFG_EVENT_FINISHED || event->type == WFG_EVENT_ERROR)
+        printf("%d\n", event->duration);
+    else
+        return;
+    fflush(stdout);
+}
+
+// -p fd: one JSON line per event. A progress event is dropped when the
+// reader has not made room for it yet, the others wait for it. Lines up to
+// PIPE_BUF are written at once, so batch threads sharing fd do not mix.
+static void writeEvent(void *opaque, const WfgEvent *event)
+{
+    int fd = (int)(intptr_t)opaque;
+    struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+    char line[PIPE_BUF];
+    int len = wfg_formatEvent(event, line, sizeof(line));
+    int done = 0;
+    ssize_t n;
     
-    if(argc < 2)
+    if(len <= 0)
+        return;
+    while(poll(&pfd, 1, event->type == WFG_EVENT_PROGRESS ? 0 : -1) < 0)
+        if(errno != EINTR)
+            return;
+    if(!(pfd.revents & POLLOUT))
+        return;
+    while(done < len)
     {
-        displayHelp();
+        n = write(fd, line + done, len - done);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return;
+        done += n;
+    }
+}
+
+// "min,max,rms" to WFG_METRIC_* flags, -1 for an unknown name
+static int parseMetrics(char *list)
+{
+    char *name, *saveptr = NULL;
+    int metrics = 0;
+    
+    for(name = strtok_r(list, ",", &saveptr); name; name = strtok_r(NULL, ",", &saveptr))
+    {
+        if(!strcmp(name, "min"))
+            metrics |= WFG_METRIC_MIN;
+        else if(!strcmp(name, "max"))
+            metrics |= WFG_METRIC_MAX;
+        else if(!strcmp(name, "rms"))
+            metrics |= WFG_METRIC_RMS;
+        else
+            return -1;
+    }
+    return metrics;
+}
+
+// one batch line: <infile>[<tab><outfile>]
+typedef struct BatchItem {
+    char *inFile;
+    char *outFile;
+    int ret;
+} BatchItem;
+
+typedef struct Batch {
+    const WfgContext *conf;
+    WfgContext **contexts;  // one per worker thread, reused for its files
+    BatchItem *items;
+} Batch;
+
+static void runBatchItem(void *arg, int item, int worker)
+{
+    Batch *batch = arg;
+    BatchItem *it = &batch->items[item];
+    WfgContext *ctx = batch->contexts[worker];
+    
+    if(!ctx)
+    {
+        ctx = batch->contexts[worker] = wfg_create();
+        if(!ctx)
+        {
+            it->ret = 1;
+            return;
+        }
+        // each worker opens its own encoders
+        wfg_copyConfig(ctx, batch->conf);
+    }
+    it->ret = wfg_generateImage(ctx, it->inFile, it->outFile);
+    printf("%d\t%s\n", it->ret, it->inFile);
+    fflush(stdout);
+}
+
+// process every file listed in listFile ("-" for stdin) on nbThreads threads
+static int runBatch(const WfgContext *conf, const char *listFile, int nbThreads)
+{
+    FILE *list = strcmp(listFile, "-") ? fopen(listFile, "r") : stdin;
+    BatchItem *items = NULL;
+    Batch batch = { conf, NULL, NULL };
+    char *line = NULL, *tab;
+    size_t size = 0;
+    int nbItems = 0, maxItems = 0, i, failed = 0;
+    
+    if(!list)
+    {
+        fprintf(stderr, "Could not open file list '%s'!\n", listFile);
         return EXIT_FAILURE;
     }
+    while(getline(&line, &size, list) > 0)
+    {
+        line[strcspn(line, "\r\n")] = 0;
+        if(!*line)
+            continue;
+        if(nbItems == maxItems)
+        {
+            maxItems = maxItems ? maxItems * 2 : 256;
+            BatchItem *grown = realloc(items, maxItems * sizeof(*items));
+            if(!grown)
+            {
+                failed = 1;
+                break;
+            }
+            items = grown;
+        }
+        tab = strchr(line, '\t');
+        if(tab)
+            *tab++ = 0;
+        items[nbItems].inFile = strdup(line);
+        items[nbItems].outFile = tab && *tab ? strdup(tab) : NULL;
+        items[nbItems].ret = 0;
+        nbItems++;
+    }
+    free(line);
+    if(list != stdin)
+        fclose(list);
     
-    width = 1800;
-    widthSmall = 800;
-    height = 140;
+    if(nbThreads <= 0)
+        nbThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    batch.items = items;
+    batch.contexts = calloc(nbThreads > 0 ? nbThreads : 1, sizeof(*batch.contexts));
+    if(failed || !batch.contexts || wfg_runPool(nbThreads, nbItems, runBatchItem, &batch))
+    {
+        fprintf(stderr, "Out of memory!\n");
+        failed = 1;
+    }
+    
+    for(i = 0; i < nbItems; i++)
+    {
+        failed |= items[i].ret;
+        free(items[i].inFile);
+        free(items[i].outFile);
+    }
+    for(i = 0; batch.contexts && i < nbThreads; i++)
+        wfg_free(&batch.contexts[i]);
+    free(batch.contexts);
+    free(items);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// parse the options of one job and run it, for the command line as well as
+// for every request of the server
+static int runJob(int argc, char *argv[])
+{
+    char* inFile = NULL;
+    char* listFile = NULL;
+    char* statsPath = NULL;
+    int nbThreads = 0, eventFd = -1, ret = EXIT_FAILURE;
+    WfgContext *ctx = wfg_create();
+    
+    if(!ctx)
+    {
+        fprintf(stderr, "Out of memory!\n");
+        return EXIT_FAILURE;
+    }
+    ctx->onEvent = printProgress;
+    bool mainWidthSet = false;
     
     // 	http://www.cs.utah.edu/dept/old/texinfo/glibc-manual-0.02/library_22.html#SEC388
     
     int c;
     
-    while((c = getopt(argc, argv, "h:i:w:W:o:")) != -1)
+#ifdef __APPLE__
+    optreset = 1;
+    optind = 1;
+#else
+    optind = 0;
+#endif
+    while((c = getopt(argc, argv, "h:i:w:W:o:j:b:t:B:Z:n:sT:P:p:R:c:am:I:x:L:gG:X")) != -1)
     {
         switch (c)
         {
             case 'i': // input
                 inFile = optarg;
                 break;
-            case 'o': // mp3
-                mFile = optarg;
+            case 'o': // encoded output, repeat for more renditions
+                if(wfg_addOutput(ctx, optarg) < 0)
+                    goto end;
                 break;
-            case 'W': // width
-                width = atoi(optarg);
+            case 'W': // width, repeat for more sizes
+                if (!mainWidthSet) {
+                    ctx->widths[0] = atoi(optarg);
+                    mainWidthSet = true;
+                } else if (ctx->nbWidths < WFG_MAX_WIDTHS) {
+                    ctx->widths[ctx->nbWidths++] = atoi(optarg);
+                } else {
+                    fprintf(stderr, "At most %d widths are supported!\n", WFG_MAX_WIDTHS);
+                    goto end;
+                }
                 break;
-            case 'w': // width
-                widthSmall = atoi(optarg);
+            case 'w': // small width
+                ctx->widths[1] = atoi(optarg);
                 break;
             case 'h': // height
-                height = atoi(optarg);
+                ctx->height = atoi(optarg);
+                break;
+            case 'j': // parallel segments
+                ctx->nbSegments = atoi(optarg);
+                break;
+            case 'x': // approximate, fraction of the input decoded
+                ctx->approximate = atof(optarg);
+                break;
+            case 'L': // live mode, ms per bucket
+                if(wfg_setLive(ctx, optarg) < 0)
+                    goto end;
+                break;
+            case 'g': // loudness, true peak and silence
+                ctx->measureLoudness = true;
+                break;
+            case 'G': // silence threshold, dBFS
+                ctx->silenceThreshold = atof(optarg);
+                break;
+            case 'X': // seek index of each output
+                ctx->seekIndex = true;
+                break;
+            case 'b': // batch file list
+                listFile = optarg;
+                break;
+            case 't': // batch threads
+                nbThreads = atoi(optarg);
+                break;
+            case 'B': // binary waveform, 8 or 16 bit
+                ctx->binaryBits = atoi(optarg);
+                break;
+            case 'Z': // samples per bucket of the finest binary level
+                ctx->zoomSamples = atoi(optarg);
+                break;
+            case 'n': // name of the result files
+                ctx->name = optarg;
+                break;
+            case 's': // results to stdout
+                ctx->jsonToStdout = true;
+                break;
+            case 'T': // stats records
+                statsPath = optarg;
+                break;
+            case 'P': // seconds between stats snapshots
+                ctx->statsInterval = atoi(optarg);
+                break;
+            case 'p': // event descriptor
+                eventFd = atoi(optarg);
+                break;
+            case 'R': // ms between progress events
+                ctx->progressInterval = atoi(optarg);
+                break;
+            case 'c': // result cache
+                ctx->cacheDir = optarg;
+                break;
+            case 'a': // cache by the decoded audio too
+                ctx->cacheByAudio = true;
+                break;
+            case 'I': // PNG image, repeat for more sizes
+                if(wfg_addImage(ctx, optarg) < 0)
+                    goto end;
+                break;
+            case 'm': // per-channel metrics
+                if((ctx->channelMetrics = parseMetrics(optarg)) < 0)
+                {
+                    fprintf(stderr, "Metrics are min, max and rms!\n");
+                    goto end;
+                }
                 break;
             default: // version
                 PRINT_VERSION;
-                return EXIT_SUCCESS;
-                break;
+                ret = EXIT_SUCCESS;
+                goto end;
         }
     }
     
@@ -92,39 +348,239 @@ int main (int argc, char *argv[])
     }
     
     
-    if(inFile == NULL)
+    if(inFile == NULL && listFile == NULL)
     {
         fprintf(stderr, "You have to specify an input file!\n");
-        return EXIT_FAILURE;
+        goto end;
+    }
+    
+    for(int i = 0; i < ctx->nbOutputs; i++)
+    {
+        if(strcmp(ctx->outputs[i].path, "-"))
+            continue;
+        if(ctx->jsonToStdout)
+        {
+            fprintf(stderr, "-s and -o - both write to stdout!\n");
+            goto end;
+        }
+        if(eventFd == STDOUT_FILENO)
+        {
+            fprintf(stderr, "-p 1 and -o - both write to stdout!\n");
+            goto end;
+        }
+        if(ctx->seekIndex)
+        {
+            fprintf(stderr, "-X does not apply to -o -, writing no index for stdout.\n");
+        }
+        // stdout carries the audio
+        ctx->onEvent = NULL;
+    }
+    if(eventFd >= 0)
+    {
+        if(fcntl(eventFd, F_GETFL) < 0)
+        {
+            fprintf(stderr, "Descriptor %d for -p is not open!\n", eventFd);
+            goto end;
+        }
+        ctx->onEvent = writeEvent;
+        ctx->eventOpaque = (void *)(intptr_t)eventFd;
+    }
+    // the bare numbers were never printed for batches
+    if(listFile && ctx->onEvent == printProgress)
+        ctx->onEvent = NULL;
+    if(inFile && !strcmp(inFile, "-") && !ctx->name && (!ctx->jsonToStdout || ctx->nbImages))
+    {
+        fprintf(stderr, "Name the results with -n when reading stdin!\n");
+        goto end;
     }
     
     // a too small width would make the audio file buffer quite large.
-    if(width < 10)
+    for(int i = 0; i < ctx->nbWidths; i++)
     {
-        fprintf(stderr, "Please specify a width greater than 10!\n");
-        return EXIT_FAILURE;
+        if(ctx->widths[i] < 10)
+        {
+            fprintf(stderr, "Please specify a width greater than 10!\n");
+            goto end;
+        }
+    }
+    // an image is drawn from the results of its width
+    for(int i = 0; i < ctx->nbImages; i++)
+    {
+        int j = 0;
+        while(j < ctx->nbWidths && ctx->widths[j] != ctx->images[i].width)
+            j++;
+        if(j == ctx->nbWidths)
+        {
+            fprintf(stderr, "The width %d of -I is not one of -W or -w!\n", ctx->images[i].width);
+            goto end;
+        }
     }
-    bool ret;
-    ret = wfg_generateImage(inFile, mFile);
-    if(ret)
+    if(ctx->nbSegments < 1)
     {
+        fprintf(stderr, "Please specify at least 1 segment!\n");
+        goto end;
+    }
+    if(ctx->approximate < 0 || ctx->approximate >= 1)
+    {
+        fprintf(stderr, "Please specify a fraction below 1 to decode!\n");
+        goto end;
+    }
+    if(ctx->binaryBits && ctx->binaryBits != 8 && ctx->binaryBits != 16)
+    {
+        fprintf(stderr, "Binary values are 8 or 16 bit!\n");
+        goto end;
+    }
+    if(statsPath)
+    {
+        ctx->statsFile = strcmp(statsPath, "-") ? fopen(statsPath, "a") : stderr;
+        if(!ctx->statsFile)
+        {
+            fprintf(stderr, "Could not open stats file '%s'!\n", statsPath);
+            goto end;
+        }
+    }
+    if(ctx->statsInterval && !ctx->statsFile)
+    {
+        fprintf(stderr, "-P only applies with -T.\n");
+    }
+    if(ctx->cacheByAudio && !ctx->cacheDir)
+    {
+        fprintf(stderr, "-a only applies with -c.\n");
+    }
+    if(ctx->nbSegments > 1 && ctx->nbOutputs)
+    {
+        fprintf(stderr, "-j only applies without -o, decoding sequentially.\n");
+    }
+    if(ctx->approximate > 0 && ctx->nbOutputs)
+    {
+        fprintf(stderr, "-x only applies without -o, decoding everything.\n");
+    }
+    if(ctx->liveMs && (ctx->nbSegments > 1 || ctx->approximate > 0 || ctx->cacheDir))
+    {
+        fprintf(stderr, "-j, -x and -c do not apply to -L, decoding the stream as it comes.\n");
+    }
+    if(ctx->measureLoudness && (ctx->nbSegments > 1 || ctx->approximate > 0))
+    {
+        fprintf(stderr, "-j and -x do not apply to -g, decoding everything in order.\n");
+    }
+    if(listFile)
+    {
+        if(ctx->jsonToStdout)
+        {
+            fprintf(stderr, "-s does not apply to -b, writing files.\n");
+        }
+        if(ctx->nbOutputs)
+        {
+            // every file would be encoded to the same outputs
+            fprintf(stderr, "-o does not apply to -b, give each file's output after a tab in the list!\n");
+            ret = EXIT_FAILURE;
+            goto end;
+        }
+        ret = runBatch(ctx, listFile, nbThreads);
+        goto end;
+    }
+    ret = wfg_generateImage(ctx, inFile, NULL) ? EXIT_FAILURE : EXIT_SUCCESS;
+    
+end:
+    if(ctx->statsFile && ctx->statsFile != stderr)
+        fclose(ctx->statsFile);
+    wfg_free(&ctx);
+    return ret;
+}
+
+int main (int argc, char *argv[])
+{
+    if(argc < 2)
+    {
+        displayHelp();
         return EXIT_FAILURE;
     }
     
-    return EXIT_SUCCESS;
+    // -S socket [-N workers]: serve jobs given with the options below
+    if(!strcmp(argv[1], "-S"))
+    {
+        if(argc < 3)
+        {
+            fprintf(stderr, "You have to specify a socket path!\n");
+            return EXIT_FAILURE;
+        }
+        int nbWorkers = argc > 4 && !strcmp(argv[3], "-N") ? atoi(argv[4]) : 0;
+        return wfg_serve(argv[2], nbWorkers, runJob) ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+    
+    return runJob(argc, argv);
 }
 
 void displayHelp()
 {
     PRINT_VERSION;
     
-    printf("usage: waveformgen [options] <infile> <outfile>\n\n\
-           <infile>:  an audio file\n\
+    printf("usage: waveformgen [options] <infile> <outfile>\n\
+           waveformgen [options] -b list [-t threads]\n\
+           waveformgen -S socket [-N workers]\n\n\
+           <infile>:  an audio file, - for stdin\n\
            \n\
            OPTIONS:\n\
            -i file    specify input file\n\n\
-           -w dim     specify dimension as [width]. Default: 1800\n\
-           -v         display version\n\n"
+           -o spec    encode to [key=value:...]file, - for stdout; repeat\n\
+                      for more renditions of one decode, omit to only\n\
+                      write the waveform. Keys: f container, c encoder,\n\
+                      b bit rate (128k), ar sample rate, ac channels\n\
+           -X         also write <outfile>.idx beside each -o file, the\n\
+                      timestamp and byte offset of every packet and a Xing\n\
+                      TOC (format in wfi.h)\n\
+           -W dim     specify dimension as [width]. Default: 1800\n\
+                      repeat to add more widths (<infile>_<width>.json)\n\
+           -w dim     specify small width. Default: 800\n\
+           -h dim     specify height. Default: 140\n\
+           -I spec    also draw <infile>_<width>x<height>.png from the levels\n\
+                      of width, spec [key=value:...]<width>x<height>, repeat\n\
+                      for more. Keys: fg bar color, fg2 color the bars fade\n\
+                      to at the bottom, bg background; RRGGBB[AA]\n\
+           -m list    also per-channel metrics of each width, any of\n\
+                      min,max,rms, in the JSON documents as \"channels\"\n\
+           -j n       decode n time ranges in parallel (without -o)\n\
+           -x frac    decode only about this fraction of a seekable input,\n\
+                      in probes spread over it, for approximate levels\n\
+                      (without -o, ignored for inputs too short to gain)\n\
+           -L spec    live mode for streams of no known length: buckets of\n\
+                      [key=value:...]<ms>, appended to <infile>_live.jsonl\n\
+                      as they are decoded along with coarser levels. Keys:\n\
+                      c ms per chunk (Default: 1000), l levels (Default: 8)\n\
+           -g         also measure the integrated loudness (EBU R128), true\n\
+                      and sample peak, ReplayGain and the first and last\n\
+                      sample above the silence threshold, as \"loudness\"\n\
+           -G dB      silence threshold of -g in dBFS. Default: -60\n\
+           -b list    process every file listed in list (- for stdin), one\n\
+                      <infile>[<tab><outfile>] per line, printing\n\
+                      <status><tab><infile> as each one finishes\n\
+           -t n       threads for -b. Default: one per CPU\n\
+           -n name    write <name>_m.json etc. instead of <infile>_m.json\n\
+           -s         print the JSON documents to stdout, one per line in\n\
+                      the order of the widths, instead of writing files\n\
+           -B bits    also write <infile>.wfb, min/max/rms at zoom levels\n\
+                      halving the resolution, with 8 or 16 bit values\n\
+           -Z n       samples per bucket of the finest .wfb level.\n\
+                      Default: the resolution the widths are reduced from\n\
+           -T file    append a JSON stats record per job to file (- for\n\
+                      stderr): wall and CPU time per stage, bytes, frames,\n\
+                      samples and peak memory\n\
+           -P n       also a progress record every n seconds, with -T\n\
+           -p fd      write JSON events to descriptor fd instead of printing\n\
+                      the percentage: started, probed, progress, finished\n\
+                      and error, one line each; progress is dropped rather\n\
+                      than waiting for a slow reader\n\
+           -R ms      time between two progress events. Default: 1000\n\
+           -c dir     reuse the results and encoded outputs of an input\n\
+                      with the same bytes and options from dir, and store\n\
+                      new ones there (not for stdin or -o -)\n\
+           -a         with -c, also match the decoded audio, so the same\n\
+                      audio in another container hits; decodes misses twice\n\
+           -v         display version\n\n\
+           -S socket  serve jobs on a Unix socket: one line of tab separated\n\
+                      options per job, answered with its output and\n\
+                      \"exit <code>\"\n\
+           -N n       number of worker processes. Default: one per CPU\n\n"
            );
     
 }
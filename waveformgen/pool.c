@@ -0,0 +1,136 @@
+/*
+ pool.c
+
+ This file is part of waveformgen.
+ 
+ waveformgen is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ waveformgen is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with waveformgen. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "pool.h"
+
+// the items [head, tail) not yet taken from one thread's share
+typedef struct Deque {
+    pthread_mutex_t lock;
+    int head, tail;
+} Deque;
+
+typedef struct Pool {
+    Deque *deques;
+    int nbThreads;
+    wfg_task_fn task;
+    void *arg;
+} Pool;
+
+typedef struct Worker {
+    Pool *pool;
+    int index;
+    pthread_t thread;
+} Worker;
+
+// the owner takes from the front of its share
+static int popFront(Deque *d)
+{
+    int item = -1;
+    
+    pthread_mutex_lock(&d->lock);
+    if (d->head < d->tail)
+        item = d->head++;
+    pthread_mutex_unlock(&d->lock);
+    return item;
+}
+
+// thieves take from the back, away from the owner
+static int popBack(Deque *d)
+{
+    int item = -1;
+    
+    pthread_mutex_lock(&d->lock);
+    if (d->head < d->tail)
+        item = --d->tail;
+    pthread_mutex_unlock(&d->lock);
+    return item;
+}
+
+static void *work(void *arg)
+{
+    Worker *w = arg;
+    Pool *pool = w->pool;
+    int item, i;
+    
+    while (1) {
+        item = popFront(&pool->deques[w->index]);
+        // steal, starting with the next thread so thieves spread out
+        for (i = 1; item < 0 && i < pool->nbThreads; i++)
+            item = popBack(&pool->deques[(w->index + i) % pool->nbThreads]);
+        // items are never added, all shares are empty
+        if (item < 0)
+            break;
+        pool->task(pool->arg, item, w->index);
+    }
+    return NULL;
+}
+
+int wfg_runPool(int nbThreads, int nbItems, wfg_task_fn task, void *arg)
+{
+    Pool pool;
+    Worker *workers;
+    int i, started = 0;
+    
+    if (nbThreads <= 0)
+        nbThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nbThreads > nbItems)
+        nbThreads = nbItems;
+    if (nbThreads < 1)
+        return 0;
+    
+    pool.nbThreads = nbThreads;
+    pool.task = task;
+    pool.arg = arg;
+    pool.deques = calloc(nbThreads, sizeof(*pool.deques));
+    workers = calloc(nbThreads, sizeof(*workers));
+    if (!pool.deques || !workers) {
+        free(pool.deques);
+        free(workers);
+        return ENOMEM;
+    }
+    for (i = 0; i < nbThreads; i++) {
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+        pool.deques[i].head = (int)((long long)nbItems * i / nbThreads);
+        pool.deques[i].tail = (int)((long long)nbItems * (i + 1) / nbThreads);
+    }
+    
+    for (i = 0; i < nbThreads; i++) {
+        workers[i].pool = &pool;
+        workers[i].index = i;
+        if (pthread_create(&workers[i].thread, NULL, work, &workers[i]))
+            break;
+        started++;
+    }
+    // the shares of threads that could not start are stolen by the others,
+    // or run here when none started
+    if (!started)
+        work(&workers[0]);
+    for (i = 0; i < started; i++)
+        pthread_join(workers[i].thread, NULL);
+    
+    for (i = 0; i < nbThreads; i++)
+        pthread_mutex_destroy(&pool.deques[i].lock);
+    free(pool.deques);
+    free(workers);
+    return 0;
+}
@@ -0,0 +1,33 @@
+/*
+ pool.h
+
+ This file is part of waveformgen.
+ 
+ waveformgen is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ waveformgen is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with waveformgen. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef WFG_POOL_H
+#define WFG_POOL_H
+
+// runs one item on the given worker thread
+typedef void (*wfg_task_fn)(void *arg, int item, int worker);
+
+// Run task for every item in [0, nbItems) on nbThreads threads (one per CPU
+// when 0). Each thread starts on its own contiguous share of the items and,
+// once that is done, steals from the end of the others' shares, so a few
+// long inputs do not leave threads idle. Returns 0 or ENOMEM.
+int wfg_runPool(int nbThreads, int nbItems, wfg_task_fn task, void *arg);
+
+#endif
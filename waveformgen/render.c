@@ -0,0 +1,262 @@
+/*
+ render.c
+
+ This file is part of waveformgen.
+ 
+ waveformgen is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ waveformgen is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with waveformgen. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "libavcodec/avcodec.h"
+#include "libavutil/common.h"
+#include "libavutil/error.h"
+#include "libavutil/frame.h"
+#include "libavutil/mem.h"
+#include "waveformgen.h"
+#include "render.h"
+
+static int parseColor(const char *value, uint8_t *color)
+{
+    char *end;
+    unsigned long rgba = strtoul(value, &end, 16);
+    size_t len = strlen(value);
+    
+    if (*end || (len != 6 && len != 8))
+        return AVERROR(EINVAL);
+    if (len == 6)
+        rgba = rgba << 8 | 0xff;
+    WFG_PACK_RGB(color, rgba >> 24, rgba >> 16 & 0xff, rgba >> 8 & 0xff);
+    color[3] = rgba & 0xff;
+    return 0;
+}
+
+int wfg_addImage(WfgContext *ctx, const char *spec)
+{
+    WfgImage *image = &ctx->images[ctx->nbImages];
+    char *copy, *opts = NULL, *size, *key, *value, *end, *saveptr = NULL;
+    bool fadeSet = false;
+    int ret = 0;
+    
+    if (ctx->nbImages == WFG_MAX_IMAGES) {
+        fprintf(stderr, "At most %d images are supported!\n", WFG_MAX_IMAGES);
+        return AVERROR(EINVAL);
+    }
+    if (!(copy = av_strdup(spec)))
+        return AVERROR(ENOMEM);
+    memset(image, 0, sizeof(*image));
+    WFG_PACK_RGB(image->top, 0, 0, 0);
+    WFG_PACK_RGB(image->background, 0xff, 0xff, 0xff);
+    image->top[3] = image->background[3] = 0xff;
+    size = copy;
+    if (*size == '[') {
+        if (!(end = strchr(size, ']'))) {
+            ret = AVERROR(EINVAL);
+            goto end;
+        }
+        *end = 0;
+        opts = size + 1;
+        size = end + 1;
+    }
+    for (key = opts ? strtok_r(opts, ":", &saveptr) : NULL; key && ret >= 0;
+         key = strtok_r(NULL, ":", &saveptr)) {
+        if (!(value = strchr(key, '='))) {
+            ret = AVERROR(EINVAL);
+            break;
+        }
+        *value++ = 0;
+        if (!strcmp(key, "fg")) {
+            ret = parseColor(value, image->top);
+        } else if (!strcmp(key, "fg2")) {
+            ret = parseColor(value, image->bottom);
+            fadeSet = true;
+        } else if (!strcmp(key, "bg")) {
+            ret = parseColor(value, image->background);
+        } else {
+            fprintf(stderr, "Unknown image option '%s'\n", key);
+            ret = AVERROR(EINVAL);
+        }
+    }
+    if (!fadeSet)
+        memcpy(image->bottom, image->top, sizeof(image->bottom));
+    if (ret >= 0 && (sscanf(size, "%dx%d", &image->width, &image->height) != 2 ||
+                     image->width <= 0 || image->height <= 0))
+        ret = AVERROR(EINVAL);
+end:
+    if (ret < 0)
+        fprintf(stderr, "Invalid image '%s'\n", spec);
+    else
+        ctx->nbImages++;
+    av_free(copy);
+    return ret;
+}
+
+int wfg_renderImage(const WfgContext *ctx, const WfgImage *image, uint8_t *rgba,
+                    int linesize)
+{
+    int w = image->width, h = image->height;
+    uint32_t *colors, background, *row;
+    const int32_t *levels;
+    int *bars, i, x, y, d, c, index = -1;
+    
+    for (i = 0; i < ctx->nbTypedResults; i++)
+        if (ctx->widths[i] == w)
+            index = i;
+    if (index < 0) {
+        fprintf(stderr, "No results of width %d to draw!\n", w);
+        return AVERROR(EINVAL);
+    }
+    bars = av_malloc_array(w, sizeof(*bars));
+    colors = av_malloc_array(h, sizeof(*colors));
+    if (!bars || !colors) {
+        av_free(bars);
+        av_free(colors);
+        return AVERROR(ENOMEM);
+    }
+    
+    // the levels, as the rows a bar reaches out from the middle times 2
+    levels = ctx->typedResults[index].levels;
+    for (x = 0; x < w; x++)
+        bars[x] = ctx->height > 0 ? (int64_t)levels[x] * h / ctx->height : 0;
+    // the color of each row, in memory order whatever the endianness
+    for (y = 0; y < h; y++) {
+        uint8_t color[4];
+        for (c = 0; c < 4; c++)
+            color[c] = h > 1 ? image->top[c] + (image->bottom[c] - image->top[c]) * y / (h - 1) :
+                       image->top[c];
+        memcpy(&colors[y], color, sizeof(colors[y]));
+    }
+    memcpy(&background, image->background, sizeof(background));
+    
+    // a pixel is set when its row is less than half a bar from the middle;
+    // one select per pixel, which compilers vectorize
+    for (y = 0; y < h; y++) {
+        uint32_t color = colors[y];
+        row = (uint32_t *)(rgba + (size_t)y * linesize);
+        d = FFABS(2 * y + 1 - h);
+        for (x = 0; x < w; x++)
+            row[x] = bars[x] > d ? color : background;
+    }
+    av_free(bars);
+    av_free(colors);
+    return 0;
+}
+
+static int encodePng(WfgImage *image, uint8_t *pixels, int linesize,
+                     enum AVPixelFormat format, const char *path)
+{
+    AVCodecContext *enc = image->encoder;
+    AVPacket packet;
+    AVFrame *frame;
+    FILE *f;
+    int got = 0, ret;
+    
+    if (!enc) {
+        AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_PNG);
+        if (!codec)
+            return AVERROR_ENCODER_NOT_FOUND;
+        if (!(enc = avcodec_alloc_context3(codec)))
+            return AVERROR(ENOMEM);
+        enc->width     = image->width;
+        enc->height    = image->height;
+        enc->pix_fmt   = format;
+        enc->time_base = (AVRational){ 1, 1 };
+        if ((ret = avcodec_open2(enc, codec, NULL)) < 0) {
+            avcodec_free_context(&enc);
+            return ret;
+        }
+        image->encoder = enc;
+    }
+    if (!(frame = av_frame_alloc()))
+        return AVERROR(ENOMEM);
+    frame->data[0]     = pixels;
+    frame->linesize[0] = linesize;
+    frame->width       = image->width;
+    frame->height      = image->height;
+    frame->format      = format;
+    av_init_packet(&packet);
+    packet.data = NULL;
+    packet.size = 0;
+    ret = avcodec_encode_video2(enc, &packet, frame, &got);
+    av_frame_free(&frame);
+    if (ret < 0 || !got)
+        return ret < 0 ? ret : AVERROR_BUG;
+    
+    if (!(f = fopen(path, "wb"))) {
+        ret = AVERROR(errno);
+        fprintf(stderr, "Could not open '%s'\n", path);
+    } else {
+        if (fwrite(packet.data, 1, packet.size, f) != packet.size)
+            ret = AVERROR(EIO);
+        if (fclose(f) && ret >= 0)
+            ret = AVERROR(errno);
+    }
+    av_free_packet(&packet);
+    return ret;
+}
+
+int wfg_writeImages(WfgContext *ctx, const char *name)
+{
+    uint8_t *pixels = NULL;
+    size_t size = 0;
+    int i, x, y, linesize, opaque, ret = 0;
+    
+    for (i = 0; i < ctx->nbImages && ret >= 0; i++) {
+        WfgImage *image = &ctx->images[i];
+        char *path;
+        
+        linesize = FFALIGN(4 * image->width, 32);
+        if ((size_t)linesize * image->height > size) {
+            size = (size_t)linesize * image->height;
+            av_free(pixels);
+            if (!(pixels = av_malloc(size))) {
+                ret = AVERROR(ENOMEM);
+                break;
+            }
+        }
+        if ((ret = wfg_renderImage(ctx, image, pixels, linesize)) < 0)
+            break;
+        // RGB is a quarter smaller and faster to compress; packed in place
+        opaque = image->top[3] == 0xff && image->bottom[3] == 0xff &&
+                 image->background[3] == 0xff;
+        if (opaque) {
+            for (y = 0; y < image->height; y++) {
+                uint8_t *row = pixels + (size_t)y * linesize;
+                for (x = 0; x < image->width; x++)
+                    memmove(row + 3 * x, row + 4 * x, 3);
+            }
+        }
+        if (!(path = av_asprintf("%s_%dx%d.png", name, image->width, image->height))) {
+            ret = AVERROR(ENOMEM);
+            break;
+        }
+        ret = encodePng(image, pixels, linesize,
+                        opaque ? AV_PIX_FMT_RGB24 : AV_PIX_FMT_RGBA, path);
+        if (ret < 0)
+            fprintf(stderr, "Could not write '%s': %s\n", path, av_err2str(ret));
+        av_free(path);
+    }
+    av_free(pixels);
+    return ret;
+}
+
+void wfg_freeImages(WfgContext *ctx)
+{
+    int i;
+    
+    for (i = 0; i < WFG_MAX_IMAGES; i++)
+        avcodec_free_context((AVCodecContext **)&ctx->images[i].encoder);
+}
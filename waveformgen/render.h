@@ -0,0 +1,29 @@
+/*
+ render.h
+
+ This file is part of waveformgen.
+ 
+ waveformgen is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ waveformgen is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with waveformgen. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef WFG_RENDER_H
+#define WFG_RENDER_H
+
+#include "waveformgen.h"
+
+// close the PNG encoders kept by the images
+void wfg_freeImages(WfgContext *ctx);
+
+#endif
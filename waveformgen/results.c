@@ -0,0 +1,190 @@
+/*
+ results.c
+
+ This file is part of waveformgen.
+ 
+ waveformgen is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ waveformgen is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with waveformgen. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "libavutil/common.h"
+#include "libavutil/error.h"
+#include "libavutil/mem.h"
+#include "results.h"
+
+// "00" to "99", so integers are written two digits at a time
+static const char digitPairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// at most 11 characters
+static char *writeInt(char *p, int32_t v)
+{
+    char buf[12], *q = buf + sizeof(buf);
+    uint32_t u = v < 0 ? -(uint32_t)v : v;
+    int len;
+    
+    while (u >= 100) {
+        q -= 2;
+        memcpy(q, digitPairs + 2 * (u % 100), 2);
+        u /= 100;
+    }
+    if (u >= 10) {
+        q -= 2;
+        memcpy(q, digitPairs + 2 * u, 2);
+    } else {
+        *--q = '0' + u;
+    }
+    if (v < 0)
+        *--q = '-';
+    len = buf + sizeof(buf) - q;
+    memcpy(p, q, len);
+    return p + len;
+}
+
+char *wfg_writeInts(char *p, const int32_t *values, int n)
+{
+    int i;
+    
+    for (i = 0; i < n; i++) {
+        if (i)
+            *p++ = ',';
+        p = writeInt(p, values[i]);
+    }
+    return p;
+}
+
+static char *writeString(char *p, const char *str)
+{
+    size_t len = strlen(str);
+    
+    memcpy(p, str, len);
+    return p + len;
+}
+
+char *wfg_levelsJson(const WfgResult *result)
+{
+    // 11 characters and a comma per value
+    char *p = av_malloc(12 * (size_t)result->width + 1);
+    
+    if (p)
+        *wfg_writeInts(p, result->levels, result->width) = 0;
+    return p;
+}
+
+char *wfg_channelsJson(const WfgResult *result)
+{
+    static const char *const names[] = { "min", "max", "rms" };
+    const int32_t *arrays[] = { result->min, result->max, result->rms };
+    char *json, *p;
+    int c, m, sep;
+    
+    // [{"min":[...],"max":[...],"rms":[...]},...]
+    json = p = av_malloc(3 + result->nbChannels * (3 + FF_ARRAY_ELEMS(names) *
+                                                   (10 + 12 * (size_t)result->width)));
+    if (!p)
+        return NULL;
+    *p++ = '[';
+    for (c = 0; c < result->nbChannels; c++) {
+        p = writeString(p, c ? ",{" : "{");
+        for (m = sep = 0; m < FF_ARRAY_ELEMS(names); m++) {
+            if (!arrays[m])
+                continue;
+            p = writeString(p, sep ? ",\"" : "\"");
+            p = writeString(p, names[m]);
+            p = writeString(p, "\":[");
+            p = wfg_writeInts(p, arrays[m] + c * result->channelStride, result->width);
+            *p++ = ']';
+            sep = 1;
+        }
+        *p++ = '}';
+    }
+    *p++ = ']';
+    *p = 0;
+    return json;
+}
+
+int wfg_jsonSink(void *opaque, const WfgResult *result)
+{
+    WfgContext *ctx = opaque;
+    
+    if (result->index >= WFG_MAX_WIDTHS)
+        return AVERROR(EINVAL);
+    av_freep(&ctx->results[result->index]);
+    av_freep(&ctx->channelResults[result->index]);
+    if (!(ctx->results[result->index] = wfg_levelsJson(result)))
+        return AVERROR(ENOMEM);
+    ctx->nbResults = FFMAX(ctx->nbResults, result->index + 1);
+    if (!result->nbChannels)
+        return 0;
+    if (!(ctx->channelResults[result->index] = wfg_channelsJson(result)))
+        return AVERROR(ENOMEM);
+    ctx->nbChannelResults = FFMAX(ctx->nbChannelResults, result->index + 1);
+    return 0;
+}
+
+int wfg_deliverResults(WfgContext *ctx)
+{
+    const int32_t *p = ctx->resultData;
+    int64_t total = 0, count = ctx->resultSize / sizeof(*p);
+    int nbMetrics = av_popcount(ctx->channelMetrics & (WFG_METRIC_MIN | WFG_METRIC_MAX |
+                                                       WFG_METRIC_RMS));
+    int nbChannels = 0, i, m, ret;
+    
+    for (i = 0; i < ctx->nbWidths; i++)
+        total += ctx->widths[i];
+    // the levels of every width, the rest are channel arrays
+    if (!total || count < total)
+        return AVERROR(EINVAL);
+    if (nbMetrics) {
+        nbChannels = (count - total) / (nbMetrics * total);
+        if (count != total * (1 + nbMetrics * nbChannels))
+            return AVERROR(EINVAL);
+    } else if (count != total) {
+        return AVERROR(EINVAL);
+    }
+    
+    for (i = 0; i < ctx->nbWidths; i++) {
+        WfgResult *r = &ctx->typedResults[i];
+        const int32_t **arrays[] = { &r->min, &r->max, &r->rms };
+        
+        *r = (WfgResult){
+            .index         = i,
+            .width         = ctx->widths[i],
+            .height        = ctx->height,
+            .levels        = p,
+            .nbChannels    = nbChannels,
+            .channelStride = nbMetrics * ctx->widths[i],
+            .samples       = ctx->nbSamples,
+            .sampleRate    = ctx->sampleRate,
+            .duration      = ctx->duration,
+            .loudness      = ctx->hasLoudness ? &ctx->loudness : NULL,
+        };
+        p += r->width;
+        // a channel's arrays follow each other in the order of the metrics
+        for (m = 0; m < FF_ARRAY_ELEMS(arrays); m++)
+            if (nbChannels && ctx->channelMetrics & (1 << m)) {
+                *arrays[m] = p;
+                p += r->width;
+            }
+        p += (nbChannels - !!nbChannels) * r->channelStride;
+    }
+    ctx->nbTypedResults = ctx->nbWidths;
+    
+    for (i = 0; i < ctx->nbTypedResults && ctx->onResult; i++)
+        if ((ret = ctx->onResult(ctx->resultOpaque, &ctx->typedResults[i])) < 0)
+            return ret;
+    return 0;
+}
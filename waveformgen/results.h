@@ -0,0 +1,36 @@
+/*
+ results.h
+
+ This file is part of waveformgen.
+ 
+ waveformgen is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ waveformgen is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with waveformgen. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef WFG_RESULTS_H
+#define WFG_RESULTS_H
+
+#include "waveformgen.h"
+
+// lay typedResults over resultData and hand them to onResult, width by width
+int wfg_deliverResults(WfgContext *ctx);
+// the JSON text of a result, allocated: its comma separated levels, and the
+// array of one object per channel holding the metric arrays it has
+char *wfg_levelsJson(const WfgResult *result);
+char *wfg_channelsJson(const WfgResult *result);
+// write n values comma separated at p, without printf; at most 12 * n
+// characters, returns their end
+char *wfg_writeInts(char *p, const int32_t *values, int n);
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ ring.c
+
+ This file is part of waveformgen.
+ 
+ waveformgen is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ waveformgen is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with waveformgen. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include "libavutil/common.h"
+#include "libavutil/error.h"
+#include "libavutil/mem.h"
+#include "ring.h"
+
+#define WAIT_PUSH 1
+#define WAIT_POP 2
+#define SPIN_COUNT 1000
+
+// The indexes and the waiting flags are sequentially consistent: a side sets
+// its flag before it checks the indexes again, the other one moves an index
+// before it checks the flag, so either the sleeper sees the move or the mover
+// sees the flag and wakes it under the lock the sleeper holds until it waits.
+
+int wfg_ringInit(WfgRing *ring, int size)
+{
+    unsigned n = 1;
+    
+    while (n < size)
+        n <<= 1;
+    memset(ring, 0, sizeof(*ring));
+    if (!(ring->items = av_malloc_array(n, sizeof(*ring->items))))
+        return AVERROR(ENOMEM);
+    ring->mask = n - 1;
+    ring->spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_COUNT : 0;
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->cond, NULL);
+    return 0;
+}
+
+void wfg_ringFree(WfgRing *ring)
+{
+    if (!ring->items)
+        return;
+    av_freep(&ring->items);
+    pthread_mutex_destroy(&ring->lock);
+    pthread_cond_destroy(&ring->cond);
+}
+
+static int ready(WfgRing *ring, int side)
+{
+    unsigned used = atomic_load(&ring->tail) - atomic_load(&ring->head);
+    
+    if (side == WAIT_PUSH)
+        return used <= ring->mask || atomic_load(&ring->errSend);
+    return used || atomic_load(&ring->errRecv);
+}
+
+// returns once the other side moved or an error was set, maybe earlier.
+// A frame takes the other side microseconds, so with more than one CPU it is
+// polled for a while before going to sleep
+static void sleepOn(WfgRing *ring, int side)
+{
+    int i;
+    
+    for (i = 0; i < ring->spin; i++)
+        if (ready(ring, side))
+            return;
+    pthread_mutex_lock(&ring->lock);
+    atomic_fetch_or(&ring->waiting, side);
+    if (!ready(ring, side))
+        pthread_cond_wait(&ring->cond, &ring->lock);
+    atomic_fetch_and(&ring->waiting, ~side);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+static void wake(WfgRing *ring, int side)
+{
+    if (!(atomic_load(&ring->waiting) & side))
+        return;
+    pthread_mutex_lock(&ring->lock);
+    pthread_cond_broadcast(&ring->cond);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+int wfg_ringPush(WfgRing *ring, void *item, int nonblock)
+{
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    int err;
+    
+    while (1) {
+        if ((err = atomic_load(&ring->errSend)))
+            return err;
+        if (tail - atomic_load(&ring->head) <= ring->mask)
+            break;
+        if (nonblock)
+            return AVERROR(EAGAIN);
+        sleepOn(ring, WAIT_PUSH);
+    }
+    ring->items[tail & ring->mask] = item;
+    atomic_store(&ring->tail, tail + 1);
+    wake(ring, WAIT_POP);
+    return 0;
+}
+
+int wfg_ringPop(WfgRing *ring, void **item, int nonblock)
+{
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    int err;
+    
+    while (atomic_load(&ring->tail) == head) {
+        // what was pushed before the error was set is still popped
+        if ((err = atomic_load(&ring->errRecv))) {
+            if (atomic_load(&ring->tail) != head)
+                break;
+            return err;
+        }
+        if (nonblock)
+            return AVERROR(EAGAIN);
+        sleepOn(ring, WAIT_POP);
+    }
+    *item = ring->items[head & ring->mask];
+    atomic_store(&ring->head, head + 1);
+    wake(ring, WAIT_PUSH);
+    return 0;
+}
+
+static void setErr(WfgRing *ring, atomic_int *err, int value)
+{
+    atomic_store(err, value);
+    pthread_mutex_lock(&ring->lock);
+    pthread_cond_broadcast(&ring->cond);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+void wfg_ringSetErrSend(WfgRing *ring, int err)
+{
+    setErr(ring, &ring->errSend, err);
+}
+
+void wfg_ringSetErrRecv(WfgRing *ring, int err)
+{
+    setErr(ring, &ring->errRecv, err);
+}
@@ -0,0 +1,63 @@
+/*
+ ring.h
+
+ This file is part of waveformgen.
+ 
+ waveformgen is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ waveformgen is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with waveformgen. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef WFG_RING_H
+#define WFG_RING_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define WFG_RING_PAD 64
+
+// A bounded ring of pointers between exactly one producer and one consumer
+// thread. Pushing and popping only touch the two indexes; a side finding
+// the ring full or empty sleeps until the other one has moved, so a slower
+// consumer holds the producer back.
+typedef struct WfgRing {
+    void **items;
+    unsigned mask;                      // size - 1, size a power of two
+    int spin;                           // polls before sleeping
+    // each written by one side only, padded to cache lines of their own
+    char pad0[WFG_RING_PAD];
+    atomic_uint head;                   // next to pop
+    char pad1[WFG_RING_PAD];
+    atomic_uint tail;                   // next to push
+    char pad2[WFG_RING_PAD];
+    atomic_int errSend, errRecv;
+    atomic_int waiting;                 // the sides sleeping on cond
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} WfgRing;
+
+// room for at least size items
+int wfg_ringInit(WfgRing *ring, int size);
+// frees the ring, not the items left in it
+void wfg_ringFree(WfgRing *ring);
+// 0, AVERROR(EAGAIN) when full and nonblock, or the error set for the producer
+int wfg_ringPush(WfgRing *ring, void *item, int nonblock);
+// 0, AVERROR(EAGAIN) when empty and nonblock, or once empty the error set for
+// the consumer
+int wfg_ringPop(WfgRing *ring, void **item, int nonblock);
+// fail the pushes from now on, when the consumer gives up
+void wfg_ringSetErrSend(WfgRing *ring, int err);
+// end the pops once the ring is empty, AVERROR_EOF when the producer is done
+void wfg_ringSetErrRecv(WfgRing *ring, int err);
+
+#endif
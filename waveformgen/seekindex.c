@@ -0,0 +1,103 @@
+/*
+ seekindex.c
+
+ This file is part of waveformgen.
+ 
+ waveformgen is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ waveformgen is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with waveformgen. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <string.h>
+#include "libavutil/common.h"
+#include "libavutil/error.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/mem.h"
+#include "seekindex.h"
+
+int wfg_seekIndexAdd(WfgSeekIndex *index, int64_t pts, int64_t duration, int64_t offset)
+{
+    int ret;
+    
+    if (index->nbFrames == index->size) {
+        if (index->size >= (INT_MAX - sizeof(WfiHeader)) / sizeof(WfiFrame) / 2)
+            return AVERROR(ENOMEM);
+        if ((ret = av_reallocp_array(&index->frames, FFMAX(2 * index->size, 1024),
+                                     sizeof(*index->frames))) < 0) {
+            index->nbFrames = index->size = 0;
+            return ret;
+        }
+        index->size = FFMAX(2 * index->size, 1024);
+    }
+    index->frames[index->nbFrames++] = (WfiFrame){ .pts = pts, .offset = offset };
+    index->endPts = pts + duration;
+    return 0;
+}
+
+// the offset to read from for pts, the last frame starting at or before it
+static uint64_t frameOffset(const WfgSeekIndex *index, int64_t pts)
+{
+    int lo = 0, hi = index->nbFrames - 1, mid;
+    
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (index->frames[mid].pts <= pts)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return index->frames[lo].offset;
+}
+
+int wfg_seekIndexFinish(const WfgSeekIndex *index, int64_t dataEnd, int sampleRate,
+                        uint8_t **data, int *size)
+{
+    int64_t start, duration, bytes;
+    uint8_t *p;
+    int i;
+    
+    *size = sizeof(WfiHeader) + index->nbFrames * sizeof(WfiFrame);
+    if (!(*data = p = av_mallocz(*size)))
+        return AVERROR(ENOMEM);
+    memcpy(p, WFI_MAGIC, 4);
+    p[4] = WFI_VERSION;
+    AV_WL32(p + 8, sampleRate);
+    AV_WL32(p + 12, index->nbFrames);
+    AV_WL64(p + 16, index->endPts);
+    AV_WL64(p + 24, dataEnd);
+    
+    // the TOC an mp3 decoder seeks with, from every packet instead of the
+    // muxer's sampled positions
+    if (index->nbFrames) {
+        start = index->frames[0].pts;
+        duration = index->endPts - start;
+        bytes = dataEnd - index->frames[0].offset;
+        for (i = 0; i < WFI_TOC_SIZE && duration > 0 && bytes > 0; i++)
+            p[32 + i] = FFMIN(255, (frameOffset(index, start + duration * i / WFI_TOC_SIZE) -
+                                    index->frames[0].offset) * 256 / bytes);
+    }
+    
+    p += sizeof(WfiHeader);
+    for (i = 0; i < index->nbFrames; i++, p += sizeof(WfiFrame)) {
+        AV_WL64(p, index->frames[i].pts);
+        AV_WL64(p + 8, index->frames[i].offset);
+    }
+    return 0;
+}
+
+void wfg_seekIndexFree(WfgSeekIndex *index)
+{
+    av_freep(&index->frames);
+    index->nbFrames = index->size = 0;
+    index->endPts = 0;
+}
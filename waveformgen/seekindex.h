@@ -0,0 +1,43 @@
+/*
+ seekindex.h
+
+ This file is part of waveformgen.
+ 
+ waveformgen is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ waveformgen is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with waveformgen. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef WFG_SEEKINDEX_H
+#define WFG_SEEKINDEX_H
+
+#include <stdint.h>
+#include "wfi.h"
+
+// the packets of one output as they are muxed; the .idx file needs one
+// WfiFrame per packet, it grows with the output
+typedef struct WfgSeekIndex {
+    WfiFrame *frames;
+    int nbFrames, size;
+    int64_t endPts;
+} WfgSeekIndex;
+
+// a packet of duration samples at pts, about to be written at offset
+int wfg_seekIndexAdd(WfgSeekIndex *index, int64_t pts, int64_t duration, int64_t offset);
+// the .idx file of the packets added, the last of which ends at dataEnd,
+// with timestamps in samples of sampleRate
+int wfg_seekIndexFinish(const WfgSeekIndex *index, int64_t dataEnd, int sampleRate,
+                        uint8_t **data, int *size);
+void wfg_seekIndexFree(WfgSeekIndex *index);
+
+#endif
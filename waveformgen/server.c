@@ -0,0 +1,188 @@
+/*
+ server.c
+
+ This file is part of waveformgen.
+ 
+ waveformgen is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ waveformgen is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with waveformgen. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "libavformat/avformat.h"
+#include "libavfilter/avfilter.h"
+#include "server.h"
+
+#define MAX_JOB_ARGS 64
+#define MAX_WORKERS 256
+
+static volatile sig_atomic_t stopping = 0;
+
+static void onStop(int sig)
+{
+    stopping = 1;
+}
+
+// split a request line in place into argv, argv[0] being the program name
+static int splitArgs(char *line, char *argv[])
+{
+    int argc = 0;
+    char *arg, *saveptr = NULL;
+    
+    argv[argc++] = "wf";
+    line[strcspn(line, "\r\n")] = 0;
+    for (arg = strtok_r(line, "\t", &saveptr); arg && argc < MAX_JOB_ARGS - 1;
+         arg = strtok_r(NULL, "\t", &saveptr))
+        argv[argc++] = arg;
+    argv[argc] = NULL;
+    return argc;
+}
+
+// run every job of one connection, with stdout going to the client
+static void serveConnection(int conn, wfg_job_fn job)
+{
+    FILE *in = fdopen(conn, "r");
+    char *line = NULL, *argv[MAX_JOB_ARGS];
+    size_t size = 0;
+    int argc, rc, out;
+    
+    if (!in) {
+        close(conn);
+        return;
+    }
+    while (getline(&line, &size, in) > 0) {
+        argc = splitArgs(line, argv);
+        if (argc < 2)
+            continue;
+        
+        fflush(stdout);
+        out = dup(STDOUT_FILENO);
+        dup2(conn, STDOUT_FILENO);
+        rc = job(argc, argv);
+        printf("exit %d\n", rc);
+        fflush(stdout);
+        dup2(out, STDOUT_FILENO);
+        close(out);
+    }
+    free(line);
+    fclose(in);
+}
+
+static void worker(int sock, wfg_job_fn job)
+{
+    int conn;
+    
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    // a client going away must not kill the worker in the middle of a job
+    signal(SIGPIPE, SIG_IGN);
+    
+    while (1) {
+        conn = accept(sock, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("accept");
+            exit(EXIT_FAILURE);
+        }
+        serveConnection(conn, job);
+    }
+}
+
+static pid_t spawn(int sock, wfg_job_fn job)
+{
+    pid_t pid = fork();
+    
+    if (pid == 0)
+        worker(sock, job);
+    if (pid < 0)
+        perror("fork");
+    return pid;
+}
+
+int wfg_serve(const char *socketPath, int nbWorkers, wfg_job_fn job)
+{
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    pid_t workers[MAX_WORKERS], pid;
+    int sock, i;
+    
+    if (nbWorkers <= 0)
+        nbWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+    nbWorkers = nbWorkers < 1 ? 1 : nbWorkers > MAX_WORKERS ? MAX_WORKERS : nbWorkers;
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socketPath);
+        return 1;
+    }
+    strcpy(addr.sun_path, socketPath);
+    
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        perror("socket");
+        return 1;
+    }
+    unlink(socketPath);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(sock, SOMAXCONN) < 0) {
+        perror(socketPath);
+        close(sock);
+        return 1;
+    }
+    
+    // done once here, every worker starts with codecs and filters registered
+    av_register_all();
+    avfilter_register_all();
+    
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onStop;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    
+    for (i = 0; i < nbWorkers; i++)
+        workers[i] = spawn(sock, job);
+    
+    // replace workers that die until asked to stop
+    while (!stopping) {
+        pid = wait(NULL);
+        if (pid < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (i = 0; i < nbWorkers; i++) {
+            if (workers[i] == pid) {
+                workers[i] = stopping ? -1 : spawn(sock, job);
+                break;
+            }
+        }
+    }
+    
+    for (i = 0; i < nbWorkers; i++)
+        if (workers[i] > 0)
+            kill(workers[i], SIGTERM);
+    while (wait(NULL) > 0 || errno == EINTR)
+        ;
+    close(sock);
+    unlink(socketPath);
+    return 0;
+}
@@ -0,0 +1,32 @@
+/*
+ server.h
+
+ This file is part of waveformgen.
+ 
+ waveformgen is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ waveformgen is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with waveformgen. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef WFG_SERVER_H
+#define WFG_SERVER_H
+
+// runs one job from its command line, returns the process exit code
+typedef int (*wfg_job_fn)(int argc, char *argv[]);
+
+// Listen on a Unix socket and run the jobs sent to it on a pool of
+// nbWorkers pre-forked processes (one per CPU when 0). A request is one
+// line of tab separated command line arguments; the job's stdout (progress
+// and duration) is sent back on the connection, followed by "exit <code>".
+int wfg_serve(const char *socketPath, int nbWorkers, wfg_job_fn job);
+
+#endif
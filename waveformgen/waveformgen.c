@@ -36,47 +36,494 @@
 #include "libavfilter/buffersrc.h"
 #include "libavutil/opt.h"
 #include "libavutil/pixdesc.h"
+#include "libavutil/sha.h"
 #include "libavutil/bprint.h"
+#include "libavutil/time.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
 #include <pthread.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include "waveformgen.h"
+#include "allocs.h"
+#include "cache.h"
+#include "live.h"
+#include "render.h"
+#include "results.h"
+#include "ring.h"
+#include "seekindex.h"
 
-static AVFormatContext *ifmt_ctx;
-static AVFormatContext *ofmt_ctx;
 typedef struct FilteringContext {
     AVFilterContext *buffersink_ctx;
     AVFilterContext *buffersrc_ctx;
     AVFilterGraph *filter_graph;
+    AVFrame *filtered_frame;    /* reused for every frame pulled */
 } FilteringContext;
-static FilteringContext *filter_ctx;
-static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-unsigned int stream_index;
 
-static int open_input_file(const char *filename)
+/* decoded frames queued for each output and the analysis; a slower stage
+   holds the decoding back instead of buffering the input */
+#define OUTPUT_QUEUE_FRAMES 16
+/* every frame that can be queued or encoding, plus the one being sent */
+#define OUTPUT_SPARE_FRAMES (OUTPUT_QUEUE_FRAMES + 2)
+#ifdef WFG_DEBUG_ALLOCS
+/* by then every frame in circulation and pool is there, the heap
+   allocations that follow are made per frame */
+#define ALLOCS_WARMUP_FRAMES (4 * OUTPUT_SPARE_FRAMES)
+#endif
+
+/* one rendition: its own conversion, encoder and muxer on its own thread.
+   The analysis is one without spec and muxer, its graph is the wf filter */
+typedef struct OutputStream {
+    WfgOutput *spec;
+    AVFormatContext *ofmt_ctx;
+    FilteringContext fctx;
+    WfgRing queue;                  /* of AVFrame *, closed with EOF */
+    WfgRing spare;                  /* the frames done with, to reuse */
+    uint8_t *packet_buffer;         /* encoded into, grown to the frames */
+    int packet_buffer_size;
+    int allocs;                     /* of packet_buffer, on its thread */
+    pthread_t thread;
+    int started;
+    int ret;
+    int timed;                      /* collect stats */
+    WfgStats stats;                 /* its thread's, copied to published */
+    WfgStats published;             /* after every frame, under stats_lock */
+    pthread_mutex_t *stats_lock;
+    WfgContext *live;               /* the analysis of a live run */
+    int seek_index;                 /* record every packet muxed */
+    WfgSeekIndex index;
+    int64_t data_end;               /* where the last packet ended */
+} OutputStream;
+
+/* the state of one run, owned by its WfgContext */
+typedef struct WfgInternal {
+    AVFormatContext *ifmt_ctx;
+    OutputStream analysis;          /* the wf filter on its own thread */
+    unsigned int stream_index;
+    OutputStream outputs[WFG_MAX_OUTPUTS + 1];
+    int nb_outputs;
+    char *specs[WFG_MAX_OUTPUTS];   /* storage of the strings of outputs[] */
+    char *run_spec;                 /* the outfile of wfg_run() */
+    WfgOutput run_output;
+    int allocs;                     /* frames and buffers allocated */
+    int timed;                      /* collect stats, there is a statsFile */
+    pthread_mutex_t stats_lock;     /* of the published output stats */
+    int64_t start_time, last_snapshot;
+    int64_t last_progress;          /* time of the last progress event */
+    int last_percent;
+    /* live runs, used by the analysis thread until it is joined */
+    WfgLive live;
+    int live_chunk;                 /* buckets taken from the filter at once */
+    int64_t live_index;             /* of the next bucket taken */
+    int live_shift;                 /* base buckets hold 1 << live_shift of them */
+    struct WFChannelBucket *chan_base;  /* with metrics, the per-channel base */
+    int nb_channels;
+} WfgInternal;
+
+/* time spent in a stage, measured on the thread running it */
+typedef struct StageClock {
+    int64_t wall, cpu;
+} StageClock;
+
+static int64_t thread_cpu_time(void)
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * INT64_C(1000000) + ts.tv_nsec / 1000;
+}
+
+static void stage_start(StageClock *clock, int timed)
+{
+    if (!timed)
+        return;
+    clock->wall = av_gettime_relative();
+    clock->cpu = thread_cpu_time();
+}
+
+static void stage_end(WfgStats *stats, enum WfgStage stage, const StageClock *clock,
+                      int timed)
+{
+    if (!timed)
+        return;
+    stats->stages[stage].wall += (av_gettime_relative() - clock->wall) / 1e6;
+    stats->stages[stage].cpu += (thread_cpu_time() - clock->cpu) / 1e6;
+}
+
+static long peak_rss_kb(void)
+{
+    struct rusage usage;
+    
+    if (getrusage(RUSAGE_SELF, &usage) < 0)
+        return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;     /* in bytes there */
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+static void print_json_string(FILE *out, const char *str)
+{
+    fputc('"', out);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\')
+            fprintf(out, "\\%c", *str);
+        else if ((unsigned char)*str < 0x20)
+            fprintf(out, "\\u%04x", *str);
+        else
+            fputc(*str, out);
+    }
+    fputc('"', out);
+}
+
+static const char *const stage_names[WFG_NB_STAGES] = {
+    "demux", "decode", "analyze", "wait", "resample", "encode", "mux", "write"
+};
+
+/* one line, written at once when several jobs share the file */
+static int print_stats(const WfgStats *stats, const char *event, const char *infile,
+                       FILE *out)
+{
+    int i, ret;
+    
+    flockfile(out);
+    fprintf(out, "{\"event\":\"%s\",\"input\":", event);
+    print_json_string(out, infile);
+    fprintf(out, ",\"elapsed\":%.6f,\"stages\":{", stats->elapsed);
+    for (i = 0; i < WFG_NB_STAGES; i++)
+        fprintf(out, "%s\"%s\":{\"wall\":%.6f,\"cpu\":%.6f}", i ? "," : "",
+                stage_names[i], stats->stages[i].wall, stats->stages[i].cpu);
+    fprintf(out, "},\"bytes_in\":%"PRId64",\"bytes_out\":%"PRId64",\"packets_in\":%"PRId64","
+            "\"frames_decoded\":%"PRId64",\"samples_decoded\":%"PRId64","
+            "\"frames_encoded\":%"PRId64",\"packets_out\":%"PRId64",\"peak_rss_kb\":%ld}\n",
+            stats->bytesIn, stats->bytesOut, stats->packetsIn, stats->framesDecoded,
+            stats->samplesDecoded, stats->framesEncoded, stats->packetsOut,
+            stats->peakRssKb);
+    ret = fflush(out) ? AVERROR(errno) : 0;
+    funlockfile(out);
+    return ret;
+}
+
+static void add_stats(WfgStats *a, const WfgStats *b)
+{
+    int i;
+    
+    for (i = 0; i < WFG_NB_STAGES; i++) {
+        a->stages[i].wall += b->stages[i].wall;
+        a->stages[i].cpu += b->stages[i].cpu;
+    }
+    a->bytesIn += b->bytesIn;
+    a->bytesOut += b->bytesOut;
+    a->packetsIn += b->packetsIn;
+    a->framesDecoded += b->framesDecoded;
+    a->samplesDecoded += b->samplesDecoded;
+    a->framesEncoded += b->framesEncoded;
+    a->packetsOut += b->packetsOut;
+}
+
+/* a "progress" record every statsInterval seconds, with what the outputs
+   published so far */
+static void stats_snapshot(WfgContext *ctx, const char *infile)
+{
+    WfgInternal *s = ctx->internal;
+    int64_t now = av_gettime_relative();
+    WfgStats stats;
+    int i;
+    
+    if (!s->timed || ctx->statsInterval <= 0 ||
+        now - s->last_snapshot < ctx->statsInterval * INT64_C(1000000))
+        return;
+    s->last_snapshot = now;
+    stats = ctx->stats;
+    pthread_mutex_lock(&s->stats_lock);
+    for (i = 0; i < s->nb_outputs; i++)
+        add_stats(&stats, &s->outputs[i].published);
+    add_stats(&stats, &s->analysis.published);
+    pthread_mutex_unlock(&s->stats_lock);
+    stats.elapsed = (now - s->start_time) / 1e6;
+    stats.peakRssKb = peak_rss_kb();
+    print_stats(&stats, "progress", infile, ctx->statsFile);
+}
+
+static const char *const event_names[] = {
+    "started", "probed", "progress", "finished", "error"
+};
+
+static void emit_event(WfgContext *ctx, WfgEventType type, const char *infile,
+                       int64_t samples, int error)
+{
+    WfgEvent event = {
+        .type       = type,
+        .input      = infile,
+        .percent    = -1,
+        .duration   = ctx->duration,
+        .samples    = samples,
+        .sampleRate = ctx->sampleRate,
+        .error      = error,
+    };
+    
+    if (!ctx->onEvent)
+        return;
+    if (type == WFG_EVENT_FINISHED)
+        event.percent = 100;
+    else if (ctx->estimatedSamples > 0)
+        event.percent = FFMIN(samples * 100 / ctx->estimatedSamples, 100);
+    ctx->onEvent(ctx->eventOpaque, &event);
+}
+
+/* rate limited, called for every packet */
+static void report_progress(WfgContext *ctx, const char *infile, int64_t samples)
+{
+    WfgInternal *s = ctx->internal;
+    int64_t now;
+    int percent;
+    
+    if (!ctx->onEvent)
+        return;
+    now = av_gettime_relative();
+    if (now - s->last_progress < ctx->progressInterval * INT64_C(1000))
+        return;
+    percent = ctx->estimatedSamples > 0 ?
+              FFMIN(samples * 100 / ctx->estimatedSamples, 100) : -1;
+    /* without an estimate the samples are all there is to report */
+    if (percent >= 0 && percent == s->last_percent)
+        return;
+    s->last_progress = now;
+    s->last_percent = percent;
+    emit_event(ctx, WFG_EVENT_PROGRESS, infile, samples, 0);
+}
+
+static void bprint_json_string(AVBPrint *bp, const char *str)
+{
+    av_bprint_chars(bp, '"', 1);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\')
+            av_bprintf(bp, "\\%c", *str);
+        else if ((unsigned char)*str < 0x20)
+            av_bprintf(bp, "\\u%04x", *str);
+        else
+            av_bprint_chars(bp, *str, 1);
+    }
+    av_bprint_chars(bp, '"', 1);
+}
+
+int wfg_formatEvent(const WfgEvent *event, char *buf, int size)
+{
+    AVBPrint bp;
+    
+    av_bprint_init_for_buffer(&bp, buf, size);
+    av_bprintf(&bp, "{\"event\":\"%s\",\"input\":", event_names[event->type]);
+    bprint_json_string(&bp, event->input);
+    switch (event->type) {
+    case WFG_EVENT_STARTED:
+        break;
+    case WFG_EVENT_PROBED:
+        if (event->duration > 0)
+            av_bprintf(&bp, ",\"duration\":%d", event->duration);
+        else
+            av_bprintf(&bp, ",\"duration\":null");
+        av_bprintf(&bp, ",\"sample_rate\":%d", event->sampleRate);
+        break;
+    case WFG_EVENT_PROGRESS:
+        if (event->percent >= 0)
+            av_bprintf(&bp, ",\"percent\":%d", event->percent);
+        else
+            av_bprintf(&bp, ",\"percent\":null");
+        av_bprintf(&bp, ",\"samples\":%"PRId64, event->samples);
+        break;
+    case WFG_EVENT_FINISHED:
+        av_bprintf(&bp, ",\"duration\":%d,\"samples\":%"PRId64,
+                   event->duration, event->samples);
+        break;
+    case WFG_EVENT_ERROR:
+        av_bprintf(&bp, ",\"code\":%d,\"message\":", event->error);
+        bprint_json_string(&bp, av_err2str(event->error));
+        break;
+    }
+    av_bprintf(&bp, "}\n");
+    return av_bprint_is_complete(&bp) ? (int)bp.len : -1;
+}
+
+static pthread_once_t registerOnce = PTHREAD_ONCE_INIT;
+
+/* inputs are read through our own AVIOContext: local files are mapped,
+   stdin ("-") and pipes are read as the bytes arrive, anything else (URLs)
+   is left to the protocols of libavformat */
+#define INPUT_BUFFER_SIZE 65536
+
+typedef struct InputBackend {
+    int fd;
+    const uint8_t *map;     /* NULL when streaming from fd */
+    int64_t size, pos;
+} InputBackend;
+
+static int read_mapped(void *opaque, uint8_t *buf, int buf_size)
+{
+    InputBackend *in = opaque;
+    int len = FFMIN(buf_size, in->size - in->pos);
+    
+    if (len <= 0)
+        return AVERROR_EOF;
+    memcpy(buf, in->map + in->pos, len);
+    in->pos += len;
+    return len;
+}
+
+static int64_t seek_mapped(void *opaque, int64_t offset, int whence)
 {
+    InputBackend *in = opaque;
+    
+    switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE: return in->size;
+    case SEEK_SET: break;
+    case SEEK_CUR: offset += in->pos; break;
+    case SEEK_END: offset += in->size; break;
+    default: return AVERROR(EINVAL);
+    }
+    if (offset < 0 || offset > in->size)
+        return AVERROR(EINVAL);
+    return in->pos = offset;
+}
+
+static int read_stream(void *opaque, uint8_t *buf, int buf_size)
+{
+    InputBackend *in = opaque;
+    ssize_t len;
+    
+    do
+        len = read(in->fd, buf, buf_size);
+    while (len < 0 && errno == EINTR);
+    if (len < 0)
+        return AVERROR(errno);
+    return len ? len : AVERROR_EOF;
+}
+
+static void free_input_io(AVIOContext *pb)
+{
+    InputBackend *in;
+    
+    if (!pb)
+        return;
+    in = pb->opaque;
+    if (in->map)
+        munmap((void *)in->map, in->size);
+    if (in->fd > STDIN_FILENO)
+        close(in->fd);
+    av_free(in);
+    av_freep(&pb->buffer);
+    av_free(pb);
+}
+
+static void close_input_file(AVFormatContext **fmt_ctx)
+{
+    AVIOContext *pb = *fmt_ctx && ((*fmt_ctx)->flags & AVFMT_FLAG_CUSTOM_IO) ?
+                      (*fmt_ctx)->pb : NULL;
+    
+    avformat_close_input(fmt_ctx);
+    free_input_io(pb);
+}
+
+/* set up the AVIOContext for filename on a new format context, or leave
+   fmt_ctx NULL for libavformat to open it itself */
+static int open_input_io(const char *filename, AVFormatContext **fmt_ctx)
+{
+    InputBackend *in;
+    AVIOContext *pb;
+    uint8_t *buffer;
+    struct stat st;
+    int fd;
+    
+    if (!strcmp(filename, "-"))
+        fd = STDIN_FILENO;
+    else if (stat(filename, &st) < 0 || (!S_ISREG(st.st_mode) && !S_ISFIFO(st.st_mode)))
+        return 0;
+    else if ((fd = open(filename, O_RDONLY)) < 0)
+        return AVERROR(errno);
+    
+    in = av_mallocz(sizeof(*in));
+    buffer = av_malloc(INPUT_BUFFER_SIZE);
+    *fmt_ctx = avformat_alloc_context();
+    if (!in || !buffer || !*fmt_ctx)
+        goto fail;
+    in->fd = fd;
+    if (fd != STDIN_FILENO && S_ISREG(st.st_mode) && st.st_size > 0) {
+        in->size = st.st_size;
+        in->map = mmap(NULL, in->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (in->map == MAP_FAILED) {
+            in->map = NULL;
+        } else {
+            madvise((void *)in->map, in->size, MADV_SEQUENTIAL);
+        }
+    }
+    /* no seek callback makes a non seekable stream the demuxers read as
+       it comes */
+    pb = in->map ? avio_alloc_context(buffer, INPUT_BUFFER_SIZE, 0, in, read_mapped,
+                                      NULL, seek_mapped)
+                 : avio_alloc_context(buffer, INPUT_BUFFER_SIZE, 0, in, read_stream,
+                                      NULL, NULL);
+    if (!pb) {
+        if (in->map)
+            munmap((void *)in->map, in->size);
+        goto fail;
+    }
+    (*fmt_ctx)->pb = pb;
+    (*fmt_ctx)->flags |= AVFMT_FLAG_CUSTOM_IO;
+    return 0;
+fail:
+    if (fd > STDIN_FILENO)
+        close(fd);
+    av_free(in);
+    av_free(buffer);
+    avformat_free_context(*fmt_ctx);
+    *fmt_ctx = NULL;
+    return AVERROR(ENOMEM);
+}
+
+/* the index open_input_file() gives an input without an audio stream */
+#define NO_STREAM UINT_MAX
+
+static int open_input_file(const char *filename, AVFormatContext **fmt_ctx,
+                           unsigned int *index)
+{
+    AVIOContext *pb;
     int ret;
     unsigned int i;
     
-    ifmt_ctx = NULL;
-    if ((ret = avformat_open_input(&ifmt_ctx, filename, NULL, NULL)) < 0) {
+    *fmt_ctx = NULL;
+    *index = NO_STREAM;
+    if ((ret = open_input_io(filename, fmt_ctx)) < 0) {
+        fprintf(stderr, "Cannot open input file: %s", filename);
+        return ret;
+    }
+    pb = *fmt_ctx ? (*fmt_ctx)->pb : NULL;
+    if ((ret = avformat_open_input(fmt_ctx, filename, NULL, NULL)) < 0) {
         fprintf(stderr, "Cannot open input file: %s", filename);
+        /* a failed open frees the format context but not our AVIOContext */
+        free_input_io(pb);
         return ret;
     }
     
-    if ((ret = avformat_find_stream_info(ifmt_ctx, NULL)) < 0) {
+    if ((ret = avformat_find_stream_info(*fmt_ctx, NULL)) < 0) {
         fprintf(stderr, "Cannot find stream information");
         return ret;
     }
     
-    for (i = 0; i < ifmt_ctx->nb_streams; i++) {
+    for (i = 0; i < (*fmt_ctx)->nb_streams; i++) {
         AVStream *stream;
         AVCodecContext *codec_ctx;
-        stream = ifmt_ctx->streams[i];
+        stream = (*fmt_ctx)->streams[i];
         codec_ctx = stream->codec;
         /* Reencode video & audio and remux subtitles etc. */
         if (codec_ctx->codec_type == AVMEDIA_TYPE_AUDIO) {
-            stream_index = i;
+            *index = i;
+            /* so the outputs share the decoded samples instead of copying */
+            codec_ctx->refcounted_frames = 1;
             /* Open decoder */
             ret = avcodec_open2(codec_ctx,
                                 avcodec_find_decoder(codec_ctx->codec_id), NULL);
@@ -86,66 +533,163 @@ static int open_input_file(const char *filename)
             }
         }
     }
+    if (*index == NO_STREAM) {
+        fprintf(stderr, "No audio stream in %s", filename);
+        return AVERROR_STREAM_NOT_FOUND;
+    }
+    
+    av_dump_format(*fmt_ctx, 0, filename, 0);
+    return 0;
+}
+
+/* the decoder open_input_file() opened, when it got that far */
+static void close_decoder(AVFormatContext *fmt_ctx, unsigned int index)
+{
+    if (fmt_ctx && index < fmt_ctx->nb_streams)
+        avcodec_close(fmt_ctx->streams[index]->codec);
+}
+
+/* "[key=value:...]path", parsed in place */
+static int parse_output(WfgOutput *out, char *spec)
+{
+    char *opts = NULL, *key, *value, *end, *saveptr = NULL;
+    
+    memset(out, 0, sizeof(*out));
+    if (*spec == '[') {
+        if (!(end = strchr(spec, ']')))
+            return AVERROR(EINVAL);
+        *end = 0;
+        opts = spec + 1;
+        spec = end + 1;
+    }
+    out->path = spec;
+    for (key = opts ? strtok_r(opts, ":", &saveptr) : NULL; key;
+         key = strtok_r(NULL, ":", &saveptr)) {
+        if (!(value = strchr(key, '=')))
+            return AVERROR(EINVAL);
+        *value++ = 0;
+        if (!strcmp(key, "f")) {
+            out->format = value;
+        } else if (!strcmp(key, "c")) {
+            out->codec = value;
+        } else if (!strcmp(key, "b")) {
+            double rate = strtod(value, &end);
+            out->bitRate = rate * (*end == 'k' ? 1000 : *end == 'M' ? 1000000 : 1);
+        } else if (!strcmp(key, "ar")) {
+            out->sampleRate = atoi(value);
+        } else if (!strcmp(key, "ac")) {
+            out->channels = atoi(value);
+        } else {
+            fprintf(stderr, "Unknown output option '%s'\n", key);
+            return AVERROR(EINVAL);
+        }
+    }
+    return *out->path && out->bitRate >= 0 && out->sampleRate >= 0 &&
+           out->channels >= 0 ? 0 : AVERROR(EINVAL);
+}
+
+int wfg_addOutput(WfgContext *ctx, const char *spec)
+{
+    WfgInternal *s = ctx->internal;
+    char *copy;
+    int ret;
     
-    av_dump_format(ifmt_ctx, 0, filename, 0);
+    if (ctx->nbOutputs >= WFG_MAX_OUTPUTS) {
+        fprintf(stderr, "At most %d outputs are supported\n", WFG_MAX_OUTPUTS);
+        return AVERROR(EINVAL);
+    }
+    if (!(copy = av_strdup(spec)))
+        return AVERROR(ENOMEM);
+    if ((ret = parse_output(&ctx->outputs[ctx->nbOutputs], copy)) < 0) {
+        fprintf(stderr, "Invalid output '%s'\n", spec);
+        av_free(copy);
+        return ret;
+    }
+    av_free(s->specs[ctx->nbOutputs]);
+    s->specs[ctx->nbOutputs++] = copy;
     return 0;
 }
 
-static int open_output_file(const char *filename)
+/* rate when the encoder takes it, the closest one it supports otherwise */
+static int select_sample_rate(const AVCodec *codec, int rate)
+{
+    const int *p;
+    int best = 0;
+    
+    if (!codec->supported_samplerates)
+        return rate;
+    for (p = codec->supported_samplerates; *p; p++) {
+        if (*p == rate)
+            return rate;
+        if (!best || FFABS(*p - rate) < FFABS(best - rate))
+            best = *p;
+    }
+    return best;
+}
+
+/* path "-" writes to stdout; with toMemory the output goes to a dynamic
+   buffer instead, both in the given format (or mp3) */
+static int open_output_file(OutputStream *os, AVCodecContext *dec_ctx)
 {
+    const WfgOutput *spec = os->spec;
+    const char *filename = spec->path, *format = spec->format;
+    AVFormatContext *ofmt_ctx;
     AVStream *out_stream;
-    AVStream *in_stream;
-    AVCodecContext *dec_ctx, *enc_ctx;
+    AVCodecContext *enc_ctx;
     AVCodec *encoder;
     int ret;
-    unsigned int i;
     
-    ofmt_ctx = NULL;
-    avformat_alloc_output_context2(&ofmt_ctx, NULL, NULL, filename);
-    if (!ofmt_ctx) {
-        fprintf(stderr, "Could not create output context");
+    if (spec->toMemory || !filename || !strcmp(filename, "-")) {
+        filename = spec->toMemory ? "memory" : "pipe:1";
+        if (!format)
+            format = "mp3";
+    }
+    avformat_alloc_output_context2(&os->ofmt_ctx, NULL, format, filename);
+    if (!(ofmt_ctx = os->ofmt_ctx)) {
+        fprintf(stderr, "Could not create output context for '%s'", filename);
         return AVERROR_UNKNOWN;
     }
     
-    
-    for (i = 0; i < ifmt_ctx->nb_streams; i++) {
-        in_stream = ifmt_ctx->streams[i];
-        dec_ctx = in_stream->codec;
-        if (dec_ctx->codec_type == AVMEDIA_TYPE_AUDIO) {
-            out_stream = avformat_new_stream(ofmt_ctx, NULL);
-            if (!out_stream) {
-                fprintf(stderr, "Failed allocating output stream");
-                return AVERROR_UNKNOWN;
-            }
-            enc_ctx = out_stream->codec;
-            
-            /* in this example, we choose transcoding to some codec */
-            encoder = avcodec_find_encoder(ofmt_ctx->oformat->audio_codec);
-            
-            /* In this example, we transcode to same properties (picture size,
-             * sample rate etc.). These properties can be changed for output
-             * streams easily using filters */
-            enc_ctx->sample_rate = dec_ctx->sample_rate;
-            enc_ctx->channel_layout = av_get_default_channel_layout(2);
-            enc_ctx->channels = 2;
-            /* take first format from list of supported formats */
-            enc_ctx->sample_fmt = encoder->sample_fmts[0];
-            enc_ctx->time_base = (AVRational){1, enc_ctx->sample_rate};
-            
-            /* Third parameter can be used to pass settings to encoder */
-            ret = avcodec_open2(enc_ctx, encoder, NULL);
-            if (ret < 0) {
-                fprintf(stderr, "Cannot open video encoder for stream #%u", i);
-                return ret;
-            }
-        }
+    encoder = spec->codec ? avcodec_find_encoder_by_name(spec->codec) :
+                            avcodec_find_encoder(ofmt_ctx->oformat->audio_codec);
+    if (!encoder) {
+        fprintf(stderr, "No encoder found for '%s'", filename);
+        return AVERROR_ENCODER_NOT_FOUND;
+    }
+    out_stream = avformat_new_stream(ofmt_ctx, NULL);
+    if (!out_stream) {
+        fprintf(stderr, "Failed allocating output stream");
+        return AVERROR_UNKNOWN;
     }
+    enc_ctx = out_stream->codec;
+    
+    /* the filter graph of the output converts to what is set here */
+    enc_ctx->sample_rate = select_sample_rate(encoder, spec->sampleRate ?
+                                              spec->sampleRate : dec_ctx->sample_rate);
+    enc_ctx->channels = spec->channels ? spec->channels : 2;
+    enc_ctx->channel_layout = av_get_default_channel_layout(enc_ctx->channels);
+    /* take first format from list of supported formats */
+    enc_ctx->sample_fmt = encoder->sample_fmts[0];
+    enc_ctx->time_base = (AVRational){1, enc_ctx->sample_rate};
+    if (spec->bitRate)
+        enc_ctx->bit_rate = spec->bitRate;
+    /* before opening, the encoder writes its extradata then */
     if (ofmt_ctx->oformat->flags & AVFMT_GLOBALHEADER)
         enc_ctx->flags |= CODEC_FLAG_GLOBAL_HEADER;
     
+    ret = avcodec_open2(enc_ctx, encoder, NULL);
+    if (ret < 0) {
+        fprintf(stderr, "Cannot open encoder %s for '%s'", encoder->name, filename);
+        return ret;
+    }
+    
     av_dump_format(ofmt_ctx, 0, filename, 1);
     
-    if (!(ofmt_ctx->oformat->flags & AVFMT_NOFILE)) {
+    if (spec->toMemory) {
+        /* seekable, so the muxer can still update its header at the end */
+        if ((ret = avio_open_dyn_buf(&ofmt_ctx->pb)) < 0)
+            return ret;
+    } else if (!(ofmt_ctx->oformat->flags & AVFMT_NOFILE)) {
         ret = avio_open(&ofmt_ctx->pb, filename, AVIO_FLAG_WRITE);
         if (ret < 0) {
             fprintf(stderr, "Could not open output file '%s'", filename);
@@ -155,7 +699,7 @@ static int open_output_file(const char *filename)
     /* init muxer, write output file header */
     ret = avformat_write_header(ofmt_ctx, NULL);
     if (ret < 0) {
-        fprintf(stderr, "Error occurred when opening output file");
+        fprintf(stderr, "Error occurred when opening output file '%s'", filename);
         return ret;
     }
     
@@ -174,8 +718,9 @@ static int init_filter(FilteringContext* fctx, AVCodecContext *dec_ctx,
     AVFilterInOut *outputs = avfilter_inout_alloc();
     AVFilterInOut *inputs  = avfilter_inout_alloc();
     AVFilterGraph *filter_graph = avfilter_graph_alloc();
+    AVFrame *filtered_frame = av_frame_alloc();
     
-    if (!outputs || !inputs || !filter_graph) {
+    if (!outputs || !inputs || !filter_graph || !filtered_frame) {
         ret = AVERROR(ENOMEM);
         goto end;
     }
@@ -211,28 +756,32 @@ static int init_filter(FilteringContext* fctx, AVCodecContext *dec_ctx,
             goto end;
         }
         
-        ret = av_opt_set_bin(buffersink_ctx, "sample_fmts",
-                             (uint8_t*)&enc_ctx->sample_fmt, sizeof(enc_ctx->sample_fmt),
-                             AV_OPT_SEARCH_CHILDREN);
-        if (ret < 0) {
-            fprintf(stderr, "Cannot set output sample format");
-            goto end;
-        }
+        /* waveform only: leave the sink unconstrained so the analysis
+         * runs on the decoder's native format and layout */
+        if (enc_ctx) {
+            ret = av_opt_set_bin(buffersink_ctx, "sample_fmts",
+                                 (uint8_t*)&enc_ctx->sample_fmt, sizeof(enc_ctx->sample_fmt),
+                                 AV_OPT_SEARCH_CHILDREN);
+            if (ret < 0) {
+                fprintf(stderr, "Cannot set output sample format");
+                goto end;
+            }
         
-        ret = av_opt_set_bin(buffersink_ctx, "channel_layouts",
-                             (uint8_t*)&enc_ctx->channel_layout,
-                             sizeof(enc_ctx->channel_layout), AV_OPT_SEARCH_CHILDREN);
-        if (ret < 0) {
-            fprintf(stderr, "Cannot set output channel layout");
-            goto end;
-        }
+            ret = av_opt_set_bin(buffersink_ctx, "channel_layouts",
+                                 (uint8_t*)&enc_ctx->channel_layout,
+                                 sizeof(enc_ctx->channel_layout), AV_OPT_SEARCH_CHILDREN);
+            if (ret < 0) {
+                fprintf(stderr, "Cannot set output channel layout");
+                goto end;
+            }
         
-        ret = av_opt_set_bin(buffersink_ctx, "sample_rates",
-                             (uint8_t*)&enc_ctx->sample_rate, sizeof(enc_ctx->sample_rate),
-                             AV_OPT_SEARCH_CHILDREN);
-        if (ret < 0) {
-            fprintf(stderr, "Cannot set output sample rate");
-            goto end;
+            ret = av_opt_set_bin(buffersink_ctx, "sample_rates",
+                                 (uint8_t*)&enc_ctx->sample_rate, sizeof(enc_ctx->sample_rate),
+                                 AV_OPT_SEARCH_CHILDREN);
+            if (ret < 0) {
+                fprintf(stderr, "Cannot set output sample rate");
+                goto end;
+            }
         }
     } else {
         ret = AVERROR_UNKNOWN;
@@ -261,42 +810,62 @@ static int init_filter(FilteringContext* fctx, AVCodecContext *dec_ctx,
     
     if ((ret = avfilter_graph_config(filter_graph, NULL)) < 0)
         goto end;
-    av_buffersink_set_frame_size(buffersink_ctx,enc_ctx->frame_size);
+    if (enc_ctx)
+        av_buffersink_set_frame_size(buffersink_ctx,enc_ctx->frame_size);
     /* Fill FilteringContext */
     fctx->buffersrc_ctx = buffersrc_ctx;
     fctx->buffersink_ctx = buffersink_ctx;
     fctx->filter_graph = filter_graph;
+    fctx->filtered_frame = filtered_frame;
     
 end:
     avfilter_inout_free(&inputs);
     avfilter_inout_free(&outputs);
+    if (ret < 0) {
+        avfilter_graph_free(&filter_graph);
+        av_frame_free(&filtered_frame);
+    }
     
     return ret;
 }
 
-static int init_filters(const char *filter_config)
+static void free_filter(FilteringContext *fctx)
 {
-    const char *filter_spec;
-    int ret;
-    filter_ctx = av_malloc(sizeof(*filter_ctx));
-    if (!filter_ctx)
-        return AVERROR(ENOMEM);
-    
-    filter_ctx->buffersrc_ctx  = NULL;
-    filter_ctx->buffersink_ctx = NULL;
-    filter_ctx->filter_graph   = NULL;
-    
-    
-    filter_spec = filter_config; /* passthrough (dummy) filter for audio */
-    ret = init_filter(filter_ctx, ifmt_ctx->streams[stream_index]->codec,
-                      ofmt_ctx->streams[0]->codec, filter_spec);
-    if (ret)
-        return ret;
+    avfilter_graph_free(&fctx->filter_graph);
+    av_frame_free(&fctx->filtered_frame);
+}
+
+/* the encoders write into one buffer of ours, large enough for a frame of
+   nb_samples or of the encoder's frame size: the frame uncompressed or what
+   the AAC encoder asks for, whichever is larger. Encoders of variable size
+   frames only have it grown by a frame larger than those before */
+static int grow_packet_buffer(OutputStream *os, int nb_samples)
+{
+    AVCodecContext *enc_ctx = os->ofmt_ctx->streams[0]->codec;
+    int size;
     
+    size = av_samples_get_buffer_size(NULL, enc_ctx->channels,
+                                      FFMAX(nb_samples, enc_ctx->frame_size),
+                                      enc_ctx->sample_fmt, 1);
+    if (size < 0)
+        return size;
+    size = FFMAX(size, 8192 * enc_ctx->channels) + FF_MIN_BUFFER_SIZE;
+    if (size <= os->packet_buffer_size)
+        return 0;
+    av_freep(&os->packet_buffer);
+    os->packet_buffer_size = 0;
+    if (!(os->packet_buffer = av_malloc(size)))
+        return AVERROR(ENOMEM);
+    os->packet_buffer_size = size;
+    os->allocs++;
     return 0;
 }
 
-static int encode_write_frame(AVFrame *filt_frame, unsigned int stream_index, int *got_frame) {
+/* filt_frame is unreferenced, to be reused */
+static int encode_write_frame(OutputStream *os, AVFrame *filt_frame, int *got_frame)
+{
+    AVStream *st = os->ofmt_ctx->streams[0];
+    StageClock clock;
     int ret;
     int got_frame_local;
     AVPacket enc_pkt;
@@ -304,37 +873,63 @@ static int encode_write_frame(AVFrame *filt_frame, unsigned int stream_index, in
     if (!got_frame)
         got_frame = &got_frame_local;
     
-    /* encode filtered frame */
-    enc_pkt.data = NULL;
-    enc_pkt.size = 0;
+    /* encode filtered frame, into our buffer */
+    if (filt_frame && (ret = grow_packet_buffer(os, filt_frame->nb_samples)) < 0) {
+        av_frame_unref(filt_frame);
+        return ret;
+    }
     av_init_packet(&enc_pkt);
-    ret = avcodec_encode_audio2(ofmt_ctx->streams[stream_index]->codec, &enc_pkt,
-                                filt_frame, got_frame);
-    av_frame_free(&filt_frame);
+    enc_pkt.data = os->packet_buffer;
+    enc_pkt.size = os->packet_buffer_size;
+    stage_start(&clock, os->timed);
+    ret = avcodec_encode_audio2(st->codec, &enc_pkt, filt_frame, got_frame);
+    stage_end(&os->stats, WFG_STAGE_ENCODE, &clock, os->timed);
+    if (filt_frame) {
+        av_frame_unref(filt_frame);
+        os->stats.framesEncoded++;
+    }
     if (ret < 0)
         return ret;
     if (!(*got_frame))
         return 0;
     
+    /* where it will start, timed in samples of the encoder */
+    if (os->seek_index &&
+        (ret = wfg_seekIndexAdd(&os->index, enc_pkt.pts, enc_pkt.duration,
+                                avio_tell(os->ofmt_ctx->pb))) < 0) {
+        av_free_packet(&enc_pkt);
+        return ret;
+    }
+    
     /* prepare packet for muxing */
-    enc_pkt.stream_index = stream_index;
-    av_packet_rescale_ts(&enc_pkt,
-                         ofmt_ctx->streams[stream_index]->codec->time_base,
-                         ofmt_ctx->streams[stream_index]->time_base);
+    enc_pkt.stream_index = 0;
+    av_packet_rescale_ts(&enc_pkt, st->codec->time_base, st->time_base);
     
-    /* mux encoded frame */
-    ret = av_interleaved_write_frame(ofmt_ctx, &enc_pkt);
+    /* mux encoded frame; a single stream needs no interleaving, which would
+       take a copy of the packet */
+    stage_start(&clock, os->timed);
+    ret = av_write_frame(os->ofmt_ctx, &enc_pkt);
+    stage_end(&os->stats, WFG_STAGE_MUX, &clock, os->timed);
+    os->stats.packetsOut++;
+    av_free_packet(&enc_pkt);
     return ret;
 }
 
-static int filter_encode_write_frame(AVFrame *frame)
+/* with no output the filtered frames are dropped */
+static int filter_encode_write_frame(FilteringContext *filter_ctx,
+                                     OutputStream *os, AVFrame *frame)
 {
-    int ret;
-    AVFrame *filt_frame;
+    AVFrame *filt_frame = filter_ctx->filtered_frame;
+    StageClock clock;
+    int ret, timed = os && os->timed;
     
-    /* push the decoded frame into the filtergraph */
+    /* push the decoded frame into the filtergraph, the conversion of an
+       output is accounted as resampling, the analysis by the caller */
+    stage_start(&clock, timed);
     ret = av_buffersrc_add_frame_flags(filter_ctx->buffersrc_ctx,
                                        frame, 0);
+    if (timed)
+        stage_end(&os->stats, WFG_STAGE_RESAMPLE, &clock, timed);
     if (ret < 0) {
         fprintf(stderr, "Error while feeding the filtergraph");
         return ret;
@@ -342,14 +937,11 @@ static int filter_encode_write_frame(AVFrame *frame)
     
     /* pull filtered frames from the filtergraph */
     while (1) {
-        filt_frame = av_frame_alloc();
-        if (!filt_frame) {
-            ret = AVERROR(ENOMEM);
-            break;
-        }
-        
+        stage_start(&clock, timed);
         ret = av_buffersink_get_frame(filter_ctx->buffersink_ctx,
                                       filt_frame);
+        if (timed)
+            stage_end(&os->stats, WFG_STAGE_RESAMPLE, &clock, timed);
         if (ret < 0) {
             /* if no more frames for output - returns AVERROR(EAGAIN)
              * if flushed and no more frames for output - returns AVERROR_EOF
@@ -357,12 +949,17 @@ static int filter_encode_write_frame(AVFrame *frame)
              */
             if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
                 ret = 0;
-            av_frame_free(&filt_frame);
             break;
         }
         
+        if (!os) {
+            /* analysis: the wf filter has seen the samples */
+            av_frame_unref(filt_frame);
+            continue;
+        }
+        
         filt_frame->pict_type = AV_PICTURE_TYPE_NONE;
-        ret = encode_write_frame(filt_frame, 0, NULL);
+        ret = encode_write_frame(os, filt_frame, NULL);
         if (ret < 0)
             break;
     }
@@ -370,17 +967,17 @@ static int filter_encode_write_frame(AVFrame *frame)
     return ret;
 }
 
-static int flush_encoder(unsigned int stream_index)
+static int flush_encoder(OutputStream *os)
 {
     int ret;
     int got_frame;
     
-    if (!(ofmt_ctx->streams[stream_index]->codec->codec->capabilities &
+    if (!(os->ofmt_ctx->streams[0]->codec->codec->capabilities &
           CODEC_CAP_DELAY))
         return 0;
     
     while (1) {
-        ret = encode_write_frame(NULL, stream_index, &got_frame);
+        ret = encode_write_frame(os, NULL, &got_frame);
         if (ret < 0)
             break;
         if (!got_frame)
@@ -389,158 +986,1480 @@ static int flush_encoder(unsigned int stream_index)
     return ret;
 }
 
-void log_callback(void* ptr, int level, const char* fmt, va_list vl);
+static int take_live(WfgContext *ctx, int eof);
 
-AVBPrint *buffer;
-char jsonFileNameTmpl[28];
-
-int wfg_generateImage(char *infile, char *outfile)
+static void *run_output(void *arg)
 {
-    int ret, samplesPerLine, samplesPerSmallLine, sampleRate, duration = 0;
-    buffer = av_malloc(sizeof(AVBPrint));
-    av_bprint_init(buffer, width*8+1, width*8+1);
-    AVPacket packet = { .data = NULL, .size = 0 };
-    AVFrame *frame = NULL;
-    long samples;
-    long readedSamples = 0;
-    int got_frame;
-    sprintf(jsonFileNameTmpl, "%s_%%s.json", infile);
-    
-    av_log_set_callback(&log_callback);
-    
+    OutputStream *os = arg;
+    AVFrame *frame;
+    StageClock clock;
+    int ret, analysis = !os->ofmt_ctx;
     
-    av_register_all();
-    avfilter_register_all();
-    
-    if ((ret = open_input_file(infile)) < 0)
-        goto end;
-    if ((ret = open_output_file(outfile)) < 0)
-        goto end;
-    duration = ifmt_ctx->duration/1000;
-    fflush(stdout);
-    sampleRate = ifmt_ctx->streams[stream_index]->codec->sample_rate;
-    samples = ifmt_ctx->duration*sampleRate/AV_TIME_BASE;
-    samplesPerLine = samples/width;
-    samplesPerSmallLine = samples/widthSmall;
-    char filter_descr[48];
-    sprintf(filter_descr, "wf=n=%d:w=%d:h=%d,wf=n=%d:w=%d:h=%d",
-            samplesPerSmallLine, widthSmall, height, samplesPerLine, width, height);
-    if ((ret = init_filters(filter_descr)) < 0)
-        goto end;
-    
-    time_t ts, oldTs;
-    ts = oldTs = time(NULL);
-    
-    /* read all packets */
-    while (1) {
-        ts = time(NULL);
-        if((ts - oldTs) > 1) {
-            oldTs = ts;
-            printf("%ld\n", readedSamples*100/samples);
-            fflush(stdout);
+    while ((ret = wfg_ringPop(&os->queue, (void **)&frame, 0)) >= 0) {
+        /* an output accounts its stages itself, the analysis is one */
+        stage_start(&clock, os->timed && analysis);
+        ret = filter_encode_write_frame(&os->fctx, analysis ? NULL : os, frame);
+        if (analysis)
+            stage_end(&os->stats, WFG_STAGE_ANALYZE, &clock, os->timed);
+        if (os->live && ret >= 0)
+            ret = take_live(os->live, 0);
+        /* back to the decoding loop, emptied by the buffer source */
+        av_frame_unref(frame);
+        if (wfg_ringPush(&os->spare, frame, 1) < 0)
+            av_frame_free(&frame);
+        if (os->timed) {
+            pthread_mutex_lock(os->stats_lock);
+            os->published = os->stats;
+            pthread_mutex_unlock(os->stats_lock);
         }
-        
-        if ((ret = av_read_frame(ifmt_ctx, &packet)) < 0)
+        if (ret < 0)
             break;
-        if (stream_index != packet.stream_index)
-            continue;
-        
-        if (filter_ctx->filter_graph) {
-            frame = av_frame_alloc();
-            if (!frame) {
-                ret = AVERROR(ENOMEM);
-                break;
-            }
-            av_packet_rescale_ts(&packet,
-                                 ifmt_ctx->streams[stream_index]->time_base,
-                                 ifmt_ctx->streams[stream_index]->codec->time_base);
-            ret = avcodec_decode_audio4(ifmt_ctx->streams[stream_index]->codec, frame,
-                                        &got_frame, &packet);
-            if (ret < 0) {
-                av_frame_free(&frame);
-                break;
-            }
-            
-            if (got_frame) {
-                readedSamples += frame->nb_samples;
-                frame->pts = av_frame_get_best_effort_timestamp(frame);
-                ret = filter_encode_write_frame(frame);
-                av_frame_free(&frame);
-                if (ret < 0)
-                    goto end;
-            } else {
-                av_frame_free(&frame);
-            }
-        } else {
-            /* remux this frame without reencoding */
-            av_packet_rescale_ts(&packet,
-                                 ifmt_ctx->streams[stream_index]->time_base,
-                                 ofmt_ctx->streams[0]->time_base);
-            
-            ret = av_interleaved_write_frame(ofmt_ctx, &packet);
-            if (ret < 0)
-                goto end;
+    }
+    if (ret == AVERROR_EOF && analysis) {
+        /* the wf filter closes its last bucket */
+        stage_start(&clock, os->timed);
+        ret = filter_encode_write_frame(&os->fctx, NULL, NULL);
+        stage_end(&os->stats, WFG_STAGE_ANALYZE, &clock, os->timed);
+        if (os->live && ret >= 0)
+            ret = take_live(os->live, 1);
+    } else if (ret == AVERROR_EOF) {
+        /* flush the conversion, then the encoder */
+        if ((ret = filter_encode_write_frame(&os->fctx, os, NULL)) >= 0 &&
+            (ret = flush_encoder(os)) >= 0) {
+            /* before the trailer, which may seek back to update the header */
+            if (os->seek_index)
+                os->data_end = avio_tell(os->ofmt_ctx->pb);
+            ret = av_write_trailer(os->ofmt_ctx);
         }
-        av_free_packet(&packet);
     }
+    /* fail the next send of the decoding loop instead of blocking it */
+    if (ret < 0)
+        wfg_ringSetErrSend(&os->queue, ret);
+    os->ret = ret;
+    return NULL;
+}
+
+/* the outputs of this run: the configured ones, then outfile's */
+static int run_outputs(WfgContext *ctx, WfgOutput **outputs)
+{
+    int i, nb = 0;
     
-    /* flush filters and encoders */
-    /* flush filter */
-    ret = filter_encode_write_frame(NULL);
-    if (ret < 0) {
-        fprintf(stderr, "Flushing filter failed");
-        goto end;
-    }
+    for (i = 0; i < ctx->nbOutputs; i++)
+        outputs[nb++] = &ctx->outputs[i];
+    if (ctx->internal->run_spec)
+        outputs[nb++] = &ctx->internal->run_output;
+    return nb;
+}
+
+/* the outputs of the context, then outfile for this run only, each
+   started on its own thread waiting for frames */
+static int open_outputs(WfgContext *ctx)
+{
+    WfgInternal *s = ctx->internal;
+    AVCodecContext *dec_ctx = s->ifmt_ctx->streams[s->stream_index]->codec;
+    WfgOutput *specs[WFG_MAX_OUTPUTS + 1];
+    int i, nb_specs = run_outputs(ctx, specs), ret;
     
-    /* flush encoder */
-    ret = flush_encoder(0);
-    if (ret < 0) {
-        fprintf(stderr, "Flushing encoder failed");
-        goto end;
+    for (i = 0; i < nb_specs; i++) {
+        OutputStream *os = &s->outputs[s->nb_outputs++];
+        
+        memset(os, 0, sizeof(*os));
+        os->spec = specs[i];
+        os->timed = s->timed;
+        os->stats_lock = &s->stats_lock;
+        /* an index needs the output to be named, or kept in memory */
+        os->seek_index = ctx->seekIndex && (specs[i]->toMemory ||
+                                            (specs[i]->path && strcmp(specs[i]->path, "-")));
+        if ((ret = open_output_file(os, dec_ctx)) < 0 ||
+            (ret = init_filter(&os->fctx, dec_ctx, os->ofmt_ctx->streams[0]->codec,
+                               "anull")) < 0 ||
+            (ret = wfg_ringInit(&os->queue, OUTPUT_QUEUE_FRAMES)) < 0 ||
+            (ret = wfg_ringInit(&os->spare, OUTPUT_SPARE_FRAMES)) < 0 ||
+            (ret = grow_packet_buffer(os, 0)) < 0)
+            return ret;
+        os->seek_index &= !!os->ofmt_ctx->pb;
+        s->allocs++;        /* its filtered frame, its buffers are counted on close */
+        if ((ret = pthread_create(&os->thread, NULL, run_output, os)))
+            return AVERROR(ret);
+        os->started = 1;
     }
-    
-    av_write_trailer(ofmt_ctx);
-end:
-    printf("%d\n", duration);
-    av_free_packet(&packet);
-    av_frame_free(&frame);
-    
-    if (ifmt_ctx && ifmt_ctx->streams[stream_index])
-        avcodec_close(ifmt_ctx->streams[stream_index]->codec);
-    if (filter_ctx && filter_ctx->filter_graph)
-        avfilter_graph_free(&filter_ctx->filter_graph);
-    if(ofmt_ctx && ofmt_ctx->streams[0])
-        avcodec_close(ofmt_ctx->streams[0]->codec);
-    av_free(filter_ctx);
-    avformat_close_input(&ifmt_ctx);
-    if (ofmt_ctx && !(ofmt_ctx->oformat->flags & AVFMT_NOFILE))
-        avio_close(ofmt_ctx->pb);
-    avformat_free_context(ofmt_ctx);
-    
-    if (ret < 0)
-        fprintf(stderr, "Error occurred: %s", av_err2str(ret));
-    
-    return ret ? 1 : 0;
+    return 0;
 }
 
-int flag = 1;
+/* the analysis: the wf filter on the decoder's native format and layout,
+   fed like the outputs so the decoding goes on while it runs */
+static int open_analysis(WfgContext *ctx, const char *filter_descr)
+{
+    WfgInternal *s = ctx->internal;
+    OutputStream *os = &s->analysis;
+    int ret;
+    
+    os->timed = s->timed;
+    os->stats_lock = &s->stats_lock;
+    os->live = ctx->liveMs ? ctx : NULL;
+    if ((ret = init_filter(&os->fctx, s->ifmt_ctx->streams[s->stream_index]->codec,
+                           NULL, filter_descr)) < 0 ||
+        (ret = wfg_ringInit(&os->queue, OUTPUT_QUEUE_FRAMES)) < 0 ||
+        (ret = wfg_ringInit(&os->spare, OUTPUT_SPARE_FRAMES)) < 0)
+        return ret;
+    s->allocs++;        /* its filtered frame */
+    if ((ret = pthread_create(&os->thread, NULL, run_output, os)))
+        return AVERROR(ret);
+    os->started = 1;
+    return 0;
+}
 
-void log_callback(void* ptr, int level, const char* fmt, va_list vl)
+/* queue a reference to frame, in a frame the stream is done with once
+   there are enough in circulation. The last stream is given frame's own
+   reference, the others a new one: FFmpeg allocates each of those */
+static int send_ref(WfgInternal *s, OutputStream *os, AVFrame *frame, int last)
 {
-    if (level == 49) {
-        pthread_mutex_lock(&mutex);
-        av_vbprintf (buffer, fmt, vl);
-        FILE *jsonFile;
-        char jsonFileName[32];
-        sprintf(jsonFileName, jsonFileNameTmpl, flag ? "m" : "s");
-        jsonFile = fopen(jsonFileName, "w");
-        fprintf(jsonFile, "{\"width\":%d,\"height\":%d,\"samples\":[%s]}",
-                flag ? width : widthSmall, height, buffer->str);
-        fflush(jsonFile);
-        if(flag){
-            av_bprint_init(buffer, widthSmall*8+1, widthSmall*8+1);
-            flag = 0;
-        }
-        pthread_mutex_unlock(&mutex);
-    }
+    AVFrame *ref;
+    int ret;
+    
+    if (wfg_ringPop(&os->spare, (void **)&ref, 1) < 0) {
+        if (!(ref = av_frame_alloc()))
+            return AVERROR(ENOMEM);
+        s->allocs++;
+    }
+    if (last)
+        av_frame_move_ref(ref, frame);
+    else if ((ret = av_frame_ref(ref, frame)) < 0) {
+        av_frame_free(&ref);
+        return ret;
+    }
+    if ((ret = wfg_ringPush(&os->queue, ref, 0)) < 0) {
+        av_frame_free(&ref);
+        return ret;
+    }
+    return 0;
+}
+
+/* to every output and the analysis, waiting while one of them is full;
+   frame is left empty */
+static int send_frame(WfgInternal *s, AVFrame *frame)
+{
+    int last = s->analysis.started ? s->nb_outputs : s->nb_outputs - 1;
+    int i, ret;
+    
+    for (i = 0; i < s->nb_outputs; i++)
+        if ((ret = send_ref(s, &s->outputs[i], frame, i == last)) < 0)
+            return ret;
+    return s->analysis.started ? send_ref(s, &s->analysis, frame, 1) : 0;
+}
+
+/* wait for a stream's thread to finish what is queued, ret < 0 aborts it */
+static int join_stream(OutputStream *os, int ret)
+{
+    if (!os->started)
+        return ret;
+    wfg_ringSetErrRecv(&os->queue, ret < 0 ? AVERROR_EXIT : AVERROR_EOF);
+    pthread_join(os->thread, NULL);
+    os->started = 0;
+    return ret < 0 ? ret : os->ret;
+}
+
+/* the frames left in a stream's rings, and the rings */
+static void free_rings(OutputStream *os)
+{
+    AVFrame *frame;
+    
+    if (os->queue.items) {
+        /* what a stream that failed left */
+        while (wfg_ringPop(&os->queue, (void **)&frame, 1) >= 0)
+            av_frame_free(&frame);
+        wfg_ringFree(&os->queue);
+    }
+    if (os->spare.items) {
+        while (wfg_ringPop(&os->spare, (void **)&frame, 1) >= 0)
+            av_frame_free(&frame);
+        wfg_ringFree(&os->spare);
+    }
+}
+
+/* <path>.idx beside a file output, in the spec with toMemory */
+static int write_seek_index(OutputStream *os)
+{
+    WfgOutput *spec = os->spec;
+    uint8_t *data;
+    char *path;
+    FILE *f;
+    int size, ret;
+    
+    if ((ret = wfg_seekIndexFinish(&os->index, os->data_end,
+                                   os->ofmt_ctx->streams[0]->codec->sample_rate,
+                                   &data, &size)) < 0)
+        return ret;
+    if (spec->toMemory) {
+        spec->index = data;
+        spec->indexSize = size;
+        return 0;
+    }
+    if (!(path = av_asprintf("%s.idx", spec->path))) {
+        av_free(data);
+        return AVERROR(ENOMEM);
+    }
+    if (!(f = fopen(path, "wb"))) {
+        ret = AVERROR(errno);
+        fprintf(stderr, "Could not open '%s'\n", path);
+    } else {
+        if (fwrite(data, 1, size, f) != size)
+            ret = AVERROR(EIO);
+        if (fclose(f) && !ret)
+            ret = AVERROR(errno);
+    }
+    av_free(path);
+    av_free(data);
+    return ret;
+}
+
+/* let the outputs finish what is queued, flushed on success, and free
+   them; returns the first error of the run */
+static int close_outputs(WfgContext *ctx, int ret)
+{
+    WfgInternal *s = ctx->internal;
+    StageClock clock;
+    int i;
+    
+    for (i = 0; i < s->nb_outputs; i++) {
+        OutputStream *os = &s->outputs[i];
+        int err = join_stream(os, ret);
+        
+        if (err < 0 && ret >= 0) {
+            fprintf(stderr, "Encoding '%s' failed", os->ofmt_ctx->filename);
+            ret = err;
+        }
+    }
+    for (i = 0; i < s->nb_outputs; i++) {
+        OutputStream *os = &s->outputs[i];
+        AVFormatContext *ofmt_ctx = os->ofmt_ctx;
+        
+        add_stats(&ctx->stats, &os->stats);
+        s->allocs += os->allocs;
+        if (os->seek_index && ret >= 0) {
+            stage_start(&clock, s->timed);
+            if ((ret = write_seek_index(os)) < 0)
+                fprintf(stderr, "Writing the seek index of '%s' failed", os->ofmt_ctx->filename);
+            stage_end(&ctx->stats, WFG_STAGE_WRITE, &clock, s->timed);
+        }
+        wfg_seekIndexFree(&os->index);
+        free_rings(os);
+        av_freep(&os->packet_buffer);
+        free_filter(&os->fctx);
+        if (!ofmt_ctx)
+            continue;
+        if (ofmt_ctx->nb_streams)
+            avcodec_close(ofmt_ctx->streams[0]->codec);
+        if (ofmt_ctx->pb)
+            ctx->stats.bytesOut += avio_tell(ofmt_ctx->pb);
+        if (os->spec->toMemory && ofmt_ctx->pb) {
+            uint8_t *data;
+            int size = avio_close_dyn_buf(ofmt_ctx->pb, &data);
+            ofmt_ctx->pb = NULL;
+            if (ret >= 0) {
+                os->spec->data = data;
+                os->spec->size = size;
+            } else {
+                av_free(data);
+            }
+        } else if (!(ofmt_ctx->oformat->flags & AVFMT_NOFILE)) {
+            avio_closep(&ofmt_ctx->pb);
+        }
+        avformat_free_context(ofmt_ctx);
+    }
+    s->nb_outputs = 0;
+    return ret;
+}
+
+/* the wf filter keeps one base summary finer than every requested width and
+   reduces it to each of them; use their lcm when it is small enough so the
+   reduction is exact, a fixed oversampling of the largest one otherwise */
+#define BASE_OVERSAMPLE 8
+
+static int base_width(const WfgContext *ctx)
+{
+    int i, max_width = 0;
+    int64_t lcm = 1;
+    
+    for (i = 0; i < ctx->nbWidths; i++)
+        max_width = FFMAX(max_width, ctx->widths[i]);
+    for (i = 0; i < ctx->nbWidths && lcm <= BASE_OVERSAMPLE * max_width; i++)
+        lcm = lcm / av_gcd(lcm, ctx->widths[i]) * ctx->widths[i];
+    
+    return lcm <= BASE_OVERSAMPLE * max_width ? lcm : BASE_OVERSAMPLE * max_width;
+}
+
+/* seconds decoded before a segment start and thrown away, so the decoder
+   is primed and its overlap is trimmed before the analysis sees a sample */
+#define SEGMENT_PREROLL 1
+/* shorter segments are not worth a seek and a preroll */
+#define SEGMENT_MIN_SECONDS 10
+
+/* per-channel metrics of one base bucket, mirrors WFChannelBucket in
+   af_wf.c; empty when the WFBucket of the same index is */
+typedef struct WFChannelBucket {
+    double sum_sq;
+    float min, max;
+} WFChannelBucket;
+
+/* the "measured" option of the wf filter, mirrors WFLoudness in af_wf.c */
+typedef struct WFLoudness {
+    double integrated;
+    double true_peak, sample_peak;
+    int64_t start, end;
+} WFLoudness;
+
+static void merge_chan_bucket(WFChannelBucket *a, int64_t a_nb,
+                              const WFChannelBucket *b, int64_t b_nb)
+{
+    if (!b_nb)
+        return;
+    a->min = a_nb ? FFMIN(a->min, b->min) : b->min;
+    a->max = a_nb ? FFMAX(a->max, b->max) : b->max;
+    a->sum_sq += b->sum_sq;
+}
+
+/* progress shared by the segments of one run */
+typedef struct SegmentProgress {
+    pthread_mutex_t mutex;
+    int64_t samples;
+    int done;
+} SegmentProgress;
+
+typedef struct Segment {
+    SegmentProgress *progress;
+    const char *infile;
+    const char *wf_args;
+    int64_t start, end;     /* global sample range, end < 0 to read to EOF */
+    WFBucket *buckets;      /* base summary of the range */
+    int nb_buckets;
+    WFChannelBucket *chan_buckets; /* nb_channels per bucket, with metrics */
+    int nb_chan_buckets;
+    int ret;
+    int timed;
+    WfgStats stats;
+    pthread_t thread;
+} Segment;
+
+static int drain_sink(AVFilterContext *sink, AVFrame *frame)
+{
+    int ret;
+    
+    while ((ret = av_buffersink_get_frame(sink, frame)) >= 0)
+        av_frame_unref(frame);
+    return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+}
+
+/* copy a binary option of the wf filter: a pointer immediately followed by
+   its length */
+static int export_binary(AVFilterContext *wf, const char *name, void **data, int *size)
+{
+    uint8_t **value = av_opt_ptr(wf->filter->priv_class, wf->priv, name);
+    
+    if (!value)
+        return AVERROR_BUG;
+    *size = *(int *)(value + 1);
+    *data = av_memdup(*value, *size);
+    return *data || !*size ? 0 : AVERROR(ENOMEM);
+}
+
+static AVFilterContext *find_wf(AVFilterGraph *graph)
+{
+    unsigned int i;
+    
+    for (i = 0; i < graph->nb_filters; i++)
+        if (!strcmp(graph->filters[i]->filter->name, "wf"))
+            return graph->filters[i];
+    return NULL;
+}
+
+/* have the wf filter reduce its summary to every width and take the
+   numbers, before the graph goes */
+static int export_results(WfgContext *ctx, AVFilterContext *wf)
+{
+    int ret;
+    
+    if (!wf)
+        return AVERROR_BUG;
+    av_freep(&ctx->resultData);
+    if ((ret = avfilter_process_command(wf, "reduce", NULL, NULL, 0, 0)) < 0)
+        return ret;
+    return export_binary(wf, "results", (void **)&ctx->resultData, &ctx->resultSize);
+}
+
+/* have the wf filter measure the loudness of all it has seen, in the units
+   of WfgLoudness */
+static int export_loudness(WfgContext *ctx, AVFilterContext *wf)
+{
+    const WFLoudness *m;
+    uint8_t **value;
+    int ret;
+    
+    if (!wf)
+        return AVERROR_BUG;
+    if ((ret = avfilter_process_command(wf, "measure", NULL, NULL, 0, 0)) < 0)
+        return ret;
+    if (!(value = av_opt_ptr(wf->filter->priv_class, wf->priv, "measured")) ||
+        *(int *)(value + 1) != sizeof(*m))
+        return AVERROR_BUG;
+    m = (const WFLoudness *)*value;
+    ctx->loudness = (WfgLoudness){
+        .integrated     = m->integrated,
+        .truePeak       = 20 * log10(m->true_peak),
+        .samplePeak     = 20 * log10(m->sample_peak),
+        .replayGain     = -18 - m->integrated,
+        .replayGainPeak = m->true_peak,
+        .silenceStart   = m->start * 1000 / ctx->sampleRate,
+        .silenceEnd     = m->end * 1000 / ctx->sampleRate,
+    };
+    ctx->hasLoudness = true;
+    return 0;
+}
+
+/* copy the base summary out of the wf filter of a flushed graph, along
+   with its final resolution when asked, and with chan_buckets the
+   per-channel one */
+static int export_buckets(AVFilterGraph *graph, WFBucket **buckets, int *nb_buckets,
+                          int *samples_per_bucket, WFChannelBucket **chan_buckets,
+                          int *nb_chan_buckets)
+{
+    AVFilterContext *wf = find_wf(graph);
+    int ret, len;
+    
+    if (!wf)
+        return AVERROR_BUG;
+    if (samples_per_bucket) {
+        int64_t n;
+        if ((ret = av_opt_get_int(wf, "n", AV_OPT_SEARCH_CHILDREN, &n)) < 0)
+            return ret;
+        *samples_per_bucket = n;
+    }
+    if ((ret = export_binary(wf, "base", (void **)buckets, &len)) < 0)
+        return ret;
+    *nb_buckets = len / sizeof(WFBucket);
+    if (!chan_buckets)
+        return 0;
+    if ((ret = export_binary(wf, "chbase", (void **)chan_buckets, &len)) < 0)
+        return ret;
+    *nb_chan_buckets = len / sizeof(WFChannelBucket);
+    return 0;
+}
+
+/* live runs keep the base summary to twice the base width the way the wf
+   filter does for an input of unknown length: when full, pairs merge and
+   the buckets taken afterwards go to the halved index */
+static int fold_buckets(WfgContext *ctx, const WFBucket *buckets, int nb,
+                        const WFChannelBucket *chan, int nb_channels)
+{
+    WfgInternal *s = ctx->internal;
+    int max = 2 * base_width(ctx), i, j, c, k;
+    
+    if (!ctx->base && !(ctx->base = av_mallocz_array(max, sizeof(*ctx->base))))
+        return AVERROR(ENOMEM);
+    if (nb_channels && !s->chan_base) {
+        if (!(s->chan_base = av_mallocz_array(max * nb_channels, sizeof(*s->chan_base))))
+            return AVERROR(ENOMEM);
+        s->nb_channels = nb_channels;
+    }
+    nb_channels = s->chan_base ? s->nb_channels : 0;
+    for (i = 0; i < nb; i++, s->live_index++) {
+        if ((k = s->live_index >> s->live_shift) == max) {
+            /* the channels first, they go by the counts before the merge */
+            for (j = 0; j < max / 2; j++) {
+                for (c = 0; c < nb_channels; c++) {
+                    s->chan_base[j * nb_channels + c] = s->chan_base[2 * j * nb_channels + c];
+                    merge_chan_bucket(&s->chan_base[j * nb_channels + c], ctx->base[2 * j].nb,
+                                      &s->chan_base[(2 * j + 1) * nb_channels + c],
+                                      ctx->base[2 * j + 1].nb);
+                }
+                ctx->base[j] = ctx->base[2 * j];
+                wfg_mergeBucket(&ctx->base[j], &ctx->base[2 * j + 1]);
+            }
+            memset(ctx->base + max / 2, 0, max / 2 * sizeof(*ctx->base));
+            if (nb_channels)
+                memset(s->chan_base + max / 2 * nb_channels, 0,
+                       max / 2 * nb_channels * sizeof(*s->chan_base));
+            s->live_shift++;
+            ctx->samplesPerBase *= 2;
+            k = s->live_index >> s->live_shift;
+        }
+        for (c = 0; c < nb_channels; c++)
+            merge_chan_bucket(&s->chan_base[k * nb_channels + c], ctx->base[k].nb,
+                              &chan[i * nb_channels + c], buckets[i].nb);
+        wfg_mergeBucket(&ctx->base[k], &buckets[i]);
+        ctx->nbBase = k + 1;
+    }
+    return 0;
+}
+
+/* live runs, on the analysis thread: once the wf filter has closed a chunk
+   of buckets, or at EOF, append them to the rolling output, fold them into
+   the base summary and have the filter drop them */
+static int take_live(WfgContext *ctx, int eof)
+{
+    WfgInternal *s = ctx->internal;
+    OutputStream *os = &s->analysis;
+    AVFilterContext *wf = find_wf(os->fctx.filter_graph);
+    uint8_t **base, **chbase;
+    StageClock clock;
+    int nb, ret;
+    
+    if (!wf || !(base = av_opt_ptr(wf->filter->priv_class, wf->priv, "base")) ||
+        !(chbase = av_opt_ptr(wf->filter->priv_class, wf->priv, "chbase")))
+        return AVERROR_BUG;
+    nb = *(int *)(base + 1) / sizeof(WFBucket);
+    if (!nb || (!eof && nb < s->live_chunk))
+        return 0;
+    stage_start(&clock, os->timed);
+    if ((ret = wfg_liveWrite(&s->live, (const WFBucket *)*base, nb)) >= 0 &&
+        (ret = fold_buckets(ctx, (const WFBucket *)*base, nb,
+                            (const WFChannelBucket *)*chbase,
+                            *(int *)(chbase + 1) / sizeof(WFChannelBucket) / nb)) >= 0)
+        ret = avfilter_process_command(wf, "drain", NULL, NULL, 0, 0);
+    stage_end(&os->stats, WFG_STAGE_WRITE, &clock, os->timed);
+    return ret;
+}
+
+/* whether the timestamps after a seek are the ones of a sequential read:
+   PCM derives them from its constant block size, and a container either
+   stores them per packet or reads them back after a search (Ogg, FLAC).
+   The others, MP3 and ADTS among them, estimate them from the byte
+   position, which would misplace the segments */
+static int exact_seeking(const AVFormatContext *fmt_ctx, const AVStream *st)
+{
+    if (av_get_bits_per_sample(st->codec->codec_id) > 0)
+        return 1;
+    return !(fmt_ctx->iformat->flags & AVFMT_GENERIC_INDEX) ||
+           fmt_ctx->iformat->read_timestamp;
+}
+
+static void *decode_segment(void *arg)
+{
+    Segment *seg = arg;
+    AVFormatContext *fmt_ctx = NULL;
+    FilteringContext fctx = { NULL };
+    AVPacket packet = { .data = NULL, .size = 0 };
+    AVFrame *frame = av_frame_alloc();
+    AVStream *st;
+    AVCodecContext *dec_ctx = NULL;
+    AVRational sample_tb;
+    unsigned int index;
+    int64_t origin, ts, start_pts, end_pts = AV_NOPTS_VALUE, pkt_ts;
+    char spec[256], *pos = spec;
+    StageClock clock;
+    int ret, got_frame;
+    
+    if (!frame) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    if ((ret = open_input_file(seg->infile, &fmt_ctx, &index)) < 0)
+        goto end;
+    st = fmt_ctx->streams[index];
+    dec_ctx = st->codec;
+    sample_tb = (AVRational){1, dec_ctx->sample_rate};
+    origin = st->start_time == AV_NOPTS_VALUE ? 0 :
+             av_rescale_q(st->start_time, st->time_base, dec_ctx->time_base);
+    
+    /* trim to exactly [start, end) so neighbouring segments share no
+       sample, and place the buckets at the global sample position */
+    start_pts = origin + av_rescale_q(seg->start, sample_tb, dec_ctx->time_base);
+    pos += sprintf(pos, "atrim=start_pts=%"PRId64, start_pts);
+    if (seg->end >= 0) {
+        end_pts = origin + av_rescale_q(seg->end, sample_tb, dec_ctx->time_base);
+        pos += sprintf(pos, ":end_pts=%"PRId64, end_pts);
+    }
+    snprintf(pos, spec + sizeof(spec) - pos, ",wf=%s:start=%"PRId64,
+             seg->wf_args, seg->start);
+    if ((ret = init_filter(&fctx, dec_ctx, NULL, spec)) < 0)
+        goto end;
+    
+    if (seg->start > 0) {
+        ts = av_rescale_q(FFMAX(seg->start - SEGMENT_PREROLL * dec_ctx->sample_rate, 0),
+                          sample_tb, st->time_base);
+        if (st->start_time != AV_NOPTS_VALUE)
+            ts += st->start_time;
+        if ((ret = av_seek_frame(fmt_ctx, index, ts, AVSEEK_FLAG_BACKWARD)) < 0)
+            goto end;
+    }
+    
+    while (1) {
+        stage_start(&clock, seg->timed);
+        ret = av_read_frame(fmt_ctx, &packet);
+        stage_end(&seg->stats, WFG_STAGE_DEMUX, &clock, seg->timed);
+        if (ret == AVERROR_EOF) {
+            ret = 0;
+            break;
+        }
+        if (ret < 0)
+            goto end;
+        if (packet.stream_index == index) {
+            seg->stats.packetsIn++;
+            av_packet_rescale_ts(&packet, st->time_base, dec_ctx->time_base);
+            pkt_ts = packet.pts != AV_NOPTS_VALUE ? packet.pts : packet.dts;
+            stage_start(&clock, seg->timed);
+            ret = avcodec_decode_audio4(dec_ctx, frame, &got_frame, &packet);
+            stage_end(&seg->stats, WFG_STAGE_DECODE, &clock, seg->timed);
+            if (ret < 0 && pkt_ts != AV_NOPTS_VALUE && pkt_ts < start_pts) {
+                /* the first packets after a seek may not decode, they are
+                   in the preroll; past it an error fails the segment */
+                ret = 0;
+            } else if (ret >= 0 && got_frame) {
+                frame->pts = av_frame_get_best_effort_timestamp(frame);
+                if (end_pts != AV_NOPTS_VALUE && frame->pts >= end_pts) {
+                    av_frame_unref(frame);
+                    av_free_packet(&packet);
+                    break;
+                }
+                pthread_mutex_lock(&seg->progress->mutex);
+                seg->progress->samples += frame->nb_samples;
+                pthread_mutex_unlock(&seg->progress->mutex);
+                seg->stats.framesDecoded++;
+                seg->stats.samplesDecoded += frame->nb_samples;
+                stage_start(&clock, seg->timed);
+                ret = av_buffersrc_add_frame_flags(fctx.buffersrc_ctx, frame, 0);
+                if (ret >= 0)
+                    ret = drain_sink(fctx.buffersink_ctx, frame);
+                stage_end(&seg->stats, WFG_STAGE_ANALYZE, &clock, seg->timed);
+            }
+        }
+        av_free_packet(&packet);
+        if (ret < 0)
+            goto end;
+    }
+    
+    /* flush, so the wf filter closes its last bucket */
+    if ((ret = av_buffersrc_add_frame_flags(fctx.buffersrc_ctx, NULL, 0)) < 0 ||
+        (ret = drain_sink(fctx.buffersink_ctx, frame)) < 0)
+        goto end;
+    ret = export_buckets(fctx.filter_graph, &seg->buckets, &seg->nb_buckets, NULL,
+                         &seg->chan_buckets, &seg->nb_chan_buckets);
+end:
+    if (fmt_ctx && fmt_ctx->pb)
+        seg->stats.bytesIn = avio_tell(fmt_ctx->pb);
+    av_frame_free(&frame);
+    free_filter(&fctx);
+    if (dec_ctx)
+        avcodec_close(dec_ctx);
+    close_input_file(&fmt_ctx);
+    
+    pthread_mutex_lock(&seg->progress->mutex);
+    seg->ret = ret;
+    seg->progress->done++;
+    pthread_mutex_unlock(&seg->progress->mutex);
+    return NULL;
+}
+
+void wfg_mergeBucket(WFBucket *a, const WFBucket *b)
+{
+    if (!b->nb)
+        return;
+    a->min = a->nb ? FFMIN(a->min, b->min) : b->min;
+    a->max = a->nb ? FFMAX(a->max, b->max) : b->max;
+    a->sum_sq += b->sum_sq;
+    a->nb     += b->nb;
+}
+
+/* hand a merged summary to a wf instance that only reduces and logs it */
+static int reduce_buckets(WfgContext *ctx, const char *wf_args, WFBucket *buckets,
+                          int nb_buckets, WFChannelBucket *chan_buckets,
+                          int nb_chan_buckets)
+{
+    AVFilterGraph *graph = avfilter_graph_alloc();
+    AVFilterContext *wf;
+    int ret;
+    
+    if (!graph)
+        return AVERROR(ENOMEM);
+    wf = avfilter_graph_alloc_filter(graph, avfilter_get_by_name("wf"), "merge");
+    if (!wf) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    if ((ret = av_opt_set_bin(wf, "base", (uint8_t *)buckets,
+                              nb_buckets * sizeof(*buckets), AV_OPT_SEARCH_CHILDREN)) < 0 ||
+        (ret = av_opt_set_bin(wf, "chbase", (uint8_t *)chan_buckets,
+                              nb_chan_buckets * sizeof(*chan_buckets),
+                              AV_OPT_SEARCH_CHILDREN)) < 0)
+        goto end;
+    if ((ret = avfilter_init_str(wf, wf_args)) >= 0)
+        ret = export_results(ctx, wf);
+end:
+    avfilter_graph_free(&graph);
+    return ret;
+}
+
+/* decode and analyze nb time ranges on their own threads and merge them
+   bucket by bucket into what a sequential run gives */
+static int generate_segments(WfgContext *ctx, const char *infile,
+                             const char *wf_args, int64_t samples, int nb)
+{
+    Segment *segs = av_mallocz_array(nb, sizeof(*segs));
+    SegmentProgress progress = { PTHREAD_MUTEX_INITIALIZER, 0, 0 };
+    WFBucket *merged = NULL;
+    WFChannelBucket *merged_chan = NULL;
+    int i, j, c, done, nb_merged = 0, nb_channels = 0, ret = 0;
+    int64_t decoded;
+    
+    if (!segs)
+        return AVERROR(ENOMEM);
+    for (i = 0; i < nb; i++) {
+        segs[i].progress = &progress;
+        segs[i].infile = infile;
+        segs[i].wf_args = wf_args;
+        segs[i].start = samples * i / nb;
+        segs[i].end = i + 1 < nb ? samples * (i + 1) / nb : -1;
+        segs[i].timed = ctx->internal->timed;
+        if ((ret = pthread_create(&segs[i].thread, NULL, decode_segment, &segs[i]))) {
+            ret = AVERROR(ret);
+            nb = i;
+            break;
+        }
+    }
+    
+    while (1) {
+        pthread_mutex_lock(&progress.mutex);
+        done = progress.done;
+        decoded = progress.samples;
+        pthread_mutex_unlock(&progress.mutex);
+        if (done == nb)
+            break;
+        report_progress(ctx, infile, decoded);
+        /* the segments' stats are only summed once they are done */
+        ctx->stats.samplesDecoded = decoded;
+        stats_snapshot(ctx, infile);
+        usleep(100000);
+    }
+    
+    ctx->stats.samplesDecoded = 0;
+    for (i = 0; i < nb; i++) {
+        pthread_join(segs[i].thread, NULL);
+        add_stats(&ctx->stats, &segs[i].stats);
+        if (segs[i].ret < 0 && ret >= 0)
+            ret = segs[i].ret;
+        nb_merged = FFMAX(nb_merged, segs[i].nb_buckets);
+        if (segs[i].nb_buckets && segs[i].nb_chan_buckets)
+            nb_channels = segs[i].nb_chan_buckets / segs[i].nb_buckets;
+    }
+    if (ret >= 0 && !(merged = av_mallocz_array(FFMAX(nb_merged, 1), sizeof(*merged))))
+        ret = AVERROR(ENOMEM);
+    if (ret >= 0 && nb_channels &&
+        !(merged_chan = av_mallocz_array(nb_merged * nb_channels, sizeof(*merged_chan))))
+        ret = AVERROR(ENOMEM);
+    if (ret >= 0) {
+        /* buckets cut by a segment boundary are completed by the next one,
+           their channels first as those go by the counts before the merge */
+        for (i = 0; i < nb; i++)
+            for (j = 0; j < segs[i].nb_buckets; j++) {
+                for (c = 0; c < nb_channels && segs[i].nb_chan_buckets; c++)
+                    merge_chan_bucket(&merged_chan[j * nb_channels + c], merged[j].nb,
+                                      &segs[i].chan_buckets[j * nb_channels + c],
+                                      segs[i].buckets[j].nb);
+                wfg_mergeBucket(&merged[j], &segs[i].buckets[j]);
+            }
+        ret = reduce_buckets(ctx, wf_args, merged, nb_merged, merged_chan,
+                             merged_chan ? nb_merged * nb_channels : 0);
+    }
+    
+    av_free(merged_chan);
+    for (i = 0; i < nb; i++) {
+        av_free(segs[i].buckets);
+        av_free(segs[i].chan_buckets);
+    }
+    av_free(segs);
+    if (ret >= 0) {
+        ctx->base = merged;
+        ctx->nbBase = nb_merged;
+    } else {
+        av_free(merged);
+    }
+    return ret;
+}
+
+/* the approximate mode decodes a probe at the middle of each of nb equal
+   shares of the input, placed by the wf filter at their timestamps. Every
+   column of the widest width gets a probe, a larger fraction makes more of
+   them rather than longer than APPROX_PROBE_SAMPLES. Probes round up to whole
+   frames, so the fraction decoded is a lower bound; when they would cover
+   more than half of the input it is decoded whole instead */
+#define APPROX_PROBE_SAMPLES 8192
+#define APPROX_MAX_COVER 2
+
+static int64_t approx_probes(const WfgContext *ctx, const AVCodecContext *dec_ctx,
+                             int64_t samples, int64_t *probe_len)
+{
+    int64_t nb = 0, decoded = samples * ctx->approximate;
+    int i, frame = FFMAX(dec_ctx->frame_size, 1024);
+    
+    for (i = 0; i < ctx->nbWidths; i++)
+        nb = FFMAX(nb, ctx->widths[i]);
+    nb = FFMAX(nb, decoded / APPROX_PROBE_SAMPLES);
+    *probe_len = FFMAX(decoded / nb, 1);
+    /* a probe decodes a frame ahead of it and rounds up to whole frames */
+    if (nb * (*probe_len + 2 * frame) * APPROX_MAX_COVER > samples)
+        return 0;
+    return nb;
+}
+
+static int decode_probes(WfgContext *ctx, const char *infile, AVFrame *frame,
+                         int64_t samples, int64_t nb_probes, int64_t probe_len)
+{
+    WfgInternal *s = ctx->internal;
+    AVFormatContext *ifmt_ctx = s->ifmt_ctx;
+    AVStream *st = ifmt_ctx->streams[s->stream_index];
+    AVCodecContext *dec_ctx = st->codec;
+    AVRational sample_tb = { 1, dec_ctx->sample_rate };
+    AVPacket packet = { .data = NULL, .size = 0 };
+    int64_t origin, preroll, k, begin, end, pts, pos = 0;
+    StageClock clock;
+    int ret = 0, got_frame;
+    
+    origin = st->start_time == AV_NOPTS_VALUE ? 0 :
+             av_rescale_q(st->start_time, st->time_base, dec_ctx->time_base);
+    /* decoded and dropped ahead of a probe, which may depend on it */
+    preroll = FFMAX(dec_ctx->frame_size, 1024);
+    
+    for (k = 0; k < nb_probes; k++) {
+        begin = samples * k / nb_probes + (samples / nb_probes - probe_len) / 2;
+        end = begin + probe_len;
+        if (end <= pos)
+            continue;
+        /* close enough to read on to */
+        if (begin - preroll > pos) {
+            stage_start(&clock, s->timed);
+            ret = av_seek_frame(ifmt_ctx, s->stream_index,
+                                av_rescale_q(begin - preroll, sample_tb, st->time_base) +
+                                (st->start_time == AV_NOPTS_VALUE ? 0 : st->start_time),
+                                AVSEEK_FLAG_BACKWARD);
+            stage_end(&ctx->stats, WFG_STAGE_DEMUX, &clock, s->timed);
+            if (ret < 0)
+                return ret;
+            avcodec_flush_buffers(dec_ctx);
+            pos = begin - preroll;
+        }
+        report_progress(ctx, infile, samples * k / nb_probes);
+        stats_snapshot(ctx, infile);
+        
+        do {
+            stage_start(&clock, s->timed);
+            ret = av_read_frame(ifmt_ctx, &packet);
+            stage_end(&ctx->stats, WFG_STAGE_DEMUX, &clock, s->timed);
+            if (ret < 0)
+                return 0;
+            if (packet.stream_index != s->stream_index) {
+                av_free_packet(&packet);
+                continue;
+            }
+            ctx->stats.packetsIn++;
+            av_packet_rescale_ts(&packet, st->time_base, dec_ctx->time_base);
+            stage_start(&clock, s->timed);
+            ret = avcodec_decode_audio4(dec_ctx, frame, &got_frame, &packet);
+            stage_end(&ctx->stats, WFG_STAGE_DECODE, &clock, s->timed);
+            av_free_packet(&packet);
+            /* the first packets after a seek may not decode */
+            if (ret < 0 || !got_frame)
+                continue;
+            ctx->stats.framesDecoded++;
+            ctx->stats.samplesDecoded += frame->nb_samples;
+            /* a frame without a timestamp follows the one before */
+            pts = av_frame_get_best_effort_timestamp(frame);
+            if (pts != AV_NOPTS_VALUE)
+                pos = av_rescale_q(pts - origin, dec_ctx->time_base, sample_tb);
+            frame->pts = pts == AV_NOPTS_VALUE ? pts : pts - origin;
+            pos += frame->nb_samples;
+            if (pos <= begin) {
+                av_frame_unref(frame);
+                continue;
+            }
+            stage_start(&clock, s->timed);
+            ret = send_frame(s, frame);
+            stage_end(&ctx->stats, WFG_STAGE_WAIT, &clock, s->timed);
+            av_frame_unref(frame);
+            if (ret < 0)
+                return ret;
+        } while (pos < end);
+    }
+    return 0;
+}
+
+static void register_all(void)
+{
+    av_register_all();
+    avfilter_register_all();
+    /* errors are reported by us, the results taken from the wf filter */
+    av_log_set_level(AV_LOG_QUIET);
+}
+
+WfgContext *wfg_create(void)
+{
+    WfgContext *ctx;
+    
+    pthread_once(&registerOnce, register_all);
+    ctx = av_mallocz(sizeof(*ctx));
+    if (!ctx)
+        return NULL;
+    ctx->internal = av_mallocz(sizeof(*ctx->internal));
+    if (!ctx->internal) {
+        av_free(ctx);
+        return NULL;
+    }
+    pthread_mutex_init(&ctx->internal->stats_lock, NULL);
+    ctx->widths[0] = 1800;
+    ctx->widths[1] = 800;
+    ctx->nbWidths = 2;
+    ctx->height = 140;
+    ctx->nbSegments = 1;
+    ctx->silenceThreshold = -60;
+    ctx->progressInterval = 1000;
+    return ctx;
+}
+
+static void free_results(WfgContext *ctx)
+{
+    int i;
+    
+    for (i = 0; i < ctx->nbResults; i++)
+        av_freep(&ctx->results[i]);
+    ctx->nbResults = 0;
+    for (i = 0; i < ctx->nbChannelResults; i++)
+        av_freep(&ctx->channelResults[i]);
+    ctx->nbChannelResults = 0;
+    av_freep(&ctx->resultData);
+    ctx->resultSize = ctx->nbTypedResults = 0;
+    ctx->hasLoudness = false;
+    av_freep(&ctx->base);
+    ctx->nbBase = 0;
+    for (i = 0; i < ctx->nbOutputs; i++) {
+        av_freep(&ctx->outputs[i].data);
+        av_freep(&ctx->outputs[i].index);
+        ctx->outputs[i].size = ctx->outputs[i].indexSize = 0;
+    }
+}
+
+void wfg_copyConfig(WfgContext *dst, const WfgContext *src)
+{
+    struct WfgInternal *internal = dst->internal;
+    void *encoders[WFG_MAX_IMAGES];
+    int i;
+    
+    free_results(dst);
+    for (i = 0; i < WFG_MAX_IMAGES; i++)
+        encoders[i] = dst->images[i].encoder;
+    *dst = *src;
+    dst->internal = internal;
+    /* an encoder is not shared, dst reuses its own */
+    for (i = 0; i < WFG_MAX_IMAGES; i++)
+        dst->images[i].encoder = encoders[i];
+    for (i = 0; i < WFG_MAX_OUTPUTS; i++) {
+        dst->outputs[i].data = dst->outputs[i].index = NULL;
+        dst->outputs[i].size = dst->outputs[i].indexSize = 0;
+    }
+    /* everything after the configuration is of the last run */
+    memset(dst->typedResults, 0, offsetof(WfgContext, internal) -
+                                 offsetof(WfgContext, typedResults));
+}
+
+void wfg_free(WfgContext **ctx)
+{
+    int i;
+    
+    if (!*ctx)
+        return;
+    free_results(*ctx);
+    wfg_freeImages(*ctx);
+    for (i = 0; i < WFG_MAX_OUTPUTS; i++)
+        av_free((*ctx)->internal->specs[i]);
+    pthread_mutex_destroy(&(*ctx)->internal->stats_lock);
+    av_free((*ctx)->internal);
+    av_freep(ctx);
+}
+
+/* SHA-256 of the decoded samples, interleaved, and their format: the same
+   audio in another container gives the same digest */
+static int hash_audio(const char *infile, uint8_t *digest)
+{
+    AVFormatContext *fmt_ctx = NULL;
+    AVPacket packet = { .data = NULL, .size = 0 };
+    AVFrame *frame = av_frame_alloc();
+    struct AVSHA *sha = av_sha_alloc();
+    AVCodecContext *dec_ctx;
+    uint8_t *interleaved = NULL;
+    unsigned int interleaved_size = 0, stream_index = NO_STREAM;
+    int ret, got_frame, bps, channels, size, i, c;
+    char format[64];
+    
+    if (!frame || !sha) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    if ((ret = open_input_file(infile, &fmt_ctx, &stream_index)) < 0)
+        goto end;
+    dec_ctx = fmt_ctx->streams[stream_index]->codec;
+    av_sha_init(sha, 256);
+    while ((ret = av_read_frame(fmt_ctx, &packet)) >= 0) {
+        if (packet.stream_index == stream_index)
+            ret = avcodec_decode_audio4(dec_ctx, frame, &got_frame, &packet);
+        else
+            got_frame = 0;
+        av_free_packet(&packet);
+        if (ret < 0)
+            goto end;
+        if (!got_frame)
+            continue;
+        bps = av_get_bytes_per_sample(frame->format);
+        channels = av_frame_get_channels(frame);
+        size = frame->nb_samples * channels * bps;
+        if (av_sample_fmt_is_planar(frame->format)) {
+            av_fast_malloc(&interleaved, &interleaved_size, size);
+            if (!interleaved) {
+                ret = AVERROR(ENOMEM);
+                goto end;
+            }
+            for (i = 0; i < frame->nb_samples; i++)
+                for (c = 0; c < channels; c++)
+                    memcpy(interleaved + (i * channels + c) * bps,
+                           frame->extended_data[c] + i * bps, bps);
+            av_sha_update(sha, interleaved, size);
+        } else {
+            av_sha_update(sha, frame->data[0], size);
+        }
+        av_frame_unref(frame);
+    }
+    if (ret != AVERROR_EOF)
+        goto end;
+    snprintf(format, sizeof(format), "%d/%d/%d", dec_ctx->sample_rate, dec_ctx->channels,
+             av_get_packed_sample_fmt(dec_ctx->sample_fmt));
+    av_sha_update(sha, (const uint8_t *)format, strlen(format));
+    av_sha_final(sha, digest);
+    ret = 0;
+end:
+    close_decoder(fmt_ctx, stream_index);
+    close_input_file(&fmt_ctx);
+    av_frame_free(&frame);
+    av_free(interleaved);
+    av_free(sha);
+    return ret;
+}
+
+/* compute the cache keys of infile, by its bytes and with cacheByAudio by
+   its samples, and restore the results stored under one of them: 1 on a
+   hit, 0 on a miss (keys left in keys to store the results under) */
+static int cache_lookup(WfgContext *ctx, const char *infile,
+                        char (*keys)[WFG_CACHE_KEY_SIZE], int *nb_keys)
+{
+    WfgOutput *outputs[WFG_MAX_OUTPUTS + 1];
+    int nb_outputs = run_outputs(ctx, outputs), i, ret;
+    uint8_t digest[WFG_DIGEST_SIZE];
+    
+    *nb_keys = 0;
+    /* stdin is gone once hashed and stdout can not be read back to be
+       stored; URLs can not be mapped */
+    if (!strcmp(infile, "-") || wfg_hashFile(infile, digest) < 0)
+        return 0;
+    for (i = 0; i < nb_outputs; i++)
+        if (!outputs[i]->toMemory && !strcmp(outputs[i]->path, "-"))
+            return 0;
+    wfg_cacheKey(ctx, outputs, nb_outputs, digest, false, keys[(*nb_keys)++]);
+    if ((ret = wfg_cacheLoad(ctx, outputs, nb_outputs, keys[0])) == 0 && ctx->cacheByAudio) {
+        /* an undecodable input fails the run that follows */
+        if (hash_audio(infile, digest) < 0)
+            return 0;
+        wfg_cacheKey(ctx, outputs, nb_outputs, digest, true, keys[(*nb_keys)++]);
+        ret = wfg_cacheLoad(ctx, outputs, nb_outputs, keys[1]);
+    }
+    if (ret <= 0)
+        free_results(ctx);      /* what an entry failing half way restored */
+    return ret > 0;
+}
+
+int wfg_run(WfgContext *ctx, const char *infile, const char *outfile)
+{
+    WfgInternal *s = ctx->internal;
+    int ret, samplesPerBase, sampleRate, i;
+    AVPacket packet = { .data = NULL, .size = 0 };
+    AVFrame *frame = NULL;
+    long samples;
+    long readedSamples = 0;
+    int got_frame;
+    char cache_keys[2][WFG_CACHE_KEY_SIZE];
+    int nb_cache_keys = 0;
+    int64_t nb_probes = 0, probe_len;
+#ifdef WFG_DEBUG_ALLOCS
+    long heap_allocs = 0;
+#endif
+    
+    free_results(ctx);
+    ctx->cacheHit = false;
+    ctx->duration = 0;
+    ctx->nbSamples = ctx->estimatedSamples = 0;
+    memset(&s->analysis, 0, sizeof(s->analysis));
+    memset(&s->live, 0, sizeof(s->live));
+    s->live_index = s->live_shift = 0;
+    s->nb_outputs = 0;
+    s->allocs = 0;
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+    s->timed = !!ctx->statsFile;
+    s->start_time = s->last_snapshot = av_gettime_relative();
+    s->last_progress = s->start_time;
+    s->last_percent = -1;
+    ctx->sampleRate = 0;
+    StageClock clock;
+    
+    emit_event(ctx, WFG_EVENT_STARTED, infile, 0, 0);
+    if (outfile) {
+        if (!(s->run_spec = av_strdup(outfile))) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        if ((ret = parse_output(&s->run_output, s->run_spec)) < 0) {
+            fprintf(stderr, "Invalid output '%s'\n", outfile);
+            goto end;
+        }
+    }
+    /* a live stream is neither hashed nor stored */
+    if (ctx->cacheDir && !ctx->liveMs &&
+        cache_lookup(ctx, infile, cache_keys, &nb_cache_keys)) {
+        ctx->cacheHit = true;
+        emit_event(ctx, WFG_EVENT_PROBED, infile, 0, 0);
+        ret = 0;
+        goto end;
+    }
+    if ((ret = open_input_file(infile, &s->ifmt_ctx, &s->stream_index)) < 0)
+        goto end;
+    if ((ret = open_outputs(ctx)) < 0)
+        goto end;
+    AVFormatContext *ifmt_ctx = s->ifmt_ctx;
+    unsigned int stream_index = s->stream_index;
+    fflush(stdout);
+    sampleRate = ifmt_ctx->streams[stream_index]->codec->sample_rate;
+    /* only an estimate (VBR without a TOC, some streams) or even unknown:
+       it sizes the base summary, the widths are reduced from what was
+       actually decoded */
+    samples = ifmt_ctx->duration > 0 ? ifmt_ctx->duration*sampleRate/AV_TIME_BASE : 0;
+    ctx->estimatedSamples = samples;
+    ctx->duration = samples * 1000 / sampleRate;
+    samplesPerBase = FFMAX(samples/base_width(ctx), 1);
+    /* a finer base costs little and gives the .wfb file its finest level */
+    if (ctx->binaryBits && ctx->zoomSamples > 0)
+        samplesPerBase = FFMIN(samplesPerBase, ctx->zoomSamples);
+    /* a live stream has buckets of a fixed duration instead */
+    if (ctx->liveMs)
+        samplesPerBase = FFMAX(av_rescale(ctx->liveMs, sampleRate, 1000), 1);
+    ctx->samplesPerBase = samplesPerBase;
+    ctx->sampleRate = sampleRate;
+    emit_event(ctx, WFG_EVENT_PROBED, infile, 0, 0);
+    char wf_args[128 + 12 * WFG_MAX_WIDTHS], filter_descr[192 + 12 * WFG_MAX_WIDTHS];
+    char *pos = wf_args;
+    pos += sprintf(pos, "emit=0:n=%d:h=%d:w=", samplesPerBase, ctx->height);
+    for (i = 0; i < ctx->nbWidths; i++)
+        pos += sprintf(pos, i ? "|%d" : "%d", ctx->widths[i]);
+    if (ctx->channelMetrics) {
+        static const char *const metric_names[] = { "min", "max", "rms" };
+        pos += sprintf(pos, ":metrics=");
+        for (i = 0; i < FF_ARRAY_ELEMS(metric_names); i++)
+            if (ctx->channelMetrics & (1 << i))
+                pos += sprintf(pos, "%s%s", pos[-1] == '=' ? "" : "+", metric_names[i]);
+    }
+    if (ctx->measureLoudness)
+        pos += sprintf(pos, ":loudness=1:silence=%.2f", av_clipd(ctx->silenceThreshold, -200, 0));
+    
+    /* waveform only, a seekable input of known length: probes of it are
+       enough when an approximation was asked for; the loudness needs every
+       sample in order, as does a live stream */
+    if (ctx->approximate > 0 && ctx->approximate < 1 && samples > 0 && !ctx->liveMs &&
+        !ctx->measureLoudness &&
+        !s->nb_outputs && ifmt_ctx->pb && ifmt_ctx->pb->seekable)
+        nb_probes = approx_probes(ctx, ifmt_ctx->streams[stream_index]->codec,
+                                  samples, &probe_len);
+    
+    /* split the input in time ranges decoded on their own threads, only
+       when there is no output to encode in order */
+    int nbParallel = FFMIN(ctx->nbSegments, samples / (SEGMENT_MIN_SECONDS * sampleRate));
+    if (!nb_probes && !s->nb_outputs && nbParallel > 1 && !ctx->liveMs &&
+        !ctx->measureLoudness &&
+        ifmt_ctx->pb && ifmt_ctx->pb->seekable) {
+        if (exact_seeking(ifmt_ctx, ifmt_ctx->streams[stream_index])) {
+            ret = generate_segments(ctx, infile, wf_args, samples, nbParallel);
+            goto end;
+        }
+        fprintf(stderr, "Seeking in '%s' is not sample exact, decoding sequentially\n",
+                infile);
+    }
+    
+    /* a longer input than estimated coarsens the base instead of growing
+       it, a shorter one still leaves it finer than every width */
+    if (ctx->liveMs) {
+        /* the analysis thread drains the filter every chunk instead */
+        s->live_chunk = FFMAX(av_rescale(ctx->liveChunk, sampleRate, 1000) / samplesPerBase, 1);
+        if ((ret = wfg_liveOpen(&s->live, ctx, ctx->name ? ctx->name : infile,
+                                samplesPerBase, sampleRate)) < 0)
+            goto end;
+        sprintf(filter_descr, "wf=%s", wf_args);
+    } else if (ctx->binaryBits && ctx->zoomSamples > 0)
+        sprintf(filter_descr, "wf=%s", wf_args);
+    else
+        sprintf(filter_descr, "wf=%s:max=%d", wf_args, 2 * base_width(ctx));
+    if (nb_probes)
+        sprintf(filter_descr + strlen(filter_descr), ":sparse=1:total=%"PRId64, samples);
+    if ((ret = open_analysis(ctx, filter_descr)) < 0)
+        goto end;
+    /* decoded into for every packet, the stages get references to it */
+    if (!(frame = av_frame_alloc())) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    s->allocs++;
+    
+    if (nb_probes && (ret = decode_probes(ctx, infile, frame, samples, nb_probes,
+                                          probe_len)) < 0)
+        goto end;
+    
+    /* read all packets */
+    while (!nb_probes) {
+        report_progress(ctx, infile, readedSamples);
+        stats_snapshot(ctx, infile);
+        
+        stage_start(&clock, s->timed);
+        ret = av_read_frame(ifmt_ctx, &packet);
+        stage_end(&ctx->stats, WFG_STAGE_DEMUX, &clock, s->timed);
+        if (ret < 0)
+            break;
+        if (stream_index != packet.stream_index) {
+            av_free_packet(&packet);
+            continue;
+        }
+        ctx->stats.packetsIn++;
+        
+        av_packet_rescale_ts(&packet,
+                             ifmt_ctx->streams[stream_index]->time_base,
+                             ifmt_ctx->streams[stream_index]->codec->time_base);
+        stage_start(&clock, s->timed);
+        ret = avcodec_decode_audio4(ifmt_ctx->streams[stream_index]->codec, frame,
+                                    &got_frame, &packet);
+        stage_end(&ctx->stats, WFG_STAGE_DECODE, &clock, s->timed);
+        if (ret < 0)
+            break;
+        
+        if (got_frame) {
+            readedSamples += frame->nb_samples;
+            ctx->stats.framesDecoded++;
+            ctx->stats.samplesDecoded += frame->nb_samples;
+            frame->pts = av_frame_get_best_effort_timestamp(frame);
+            /* the outputs and the analysis run on their own threads; this
+               one only waits when one of them has a full queue */
+            stage_start(&clock, s->timed);
+            ret = send_frame(s, frame);
+            stage_end(&ctx->stats, WFG_STAGE_WAIT, &clock, s->timed);
+            av_frame_unref(frame);
+            if (ret < 0)
+                goto end;
+#ifdef WFG_DEBUG_ALLOCS
+            if (ctx->stats.framesDecoded == ALLOCS_WARMUP_FRAMES)
+                heap_allocs = wfg_heapAllocs();
+#endif
+        }
+        av_free_packet(&packet);
+    }
+#ifdef WFG_DEBUG_ALLOCS
+    if (ctx->stats.framesDecoded > ALLOCS_WARMUP_FRAMES)
+        fprintf(stderr, "%s: %.2f heap allocations per frame after the first %d\n", infile,
+                (double)(wfg_heapAllocs() - heap_allocs) /
+                (ctx->stats.framesDecoded - ALLOCS_WARMUP_FRAMES), ALLOCS_WARMUP_FRAMES);
+#endif
+    
+    /* the analysis flushes on its thread, as the outputs do */
+    if ((ret = join_stream(&s->analysis, 0)) < 0) {
+        fprintf(stderr, "Flushing filter failed");
+        goto end;
+    }
+    if (ctx->measureLoudness &&
+        (ret = export_loudness(ctx, find_wf(s->analysis.fctx.filter_graph))) < 0)
+        goto end;
+    if (ctx->liveMs)
+        ret = reduce_buckets(ctx, wf_args, ctx->base, ctx->nbBase, s->chan_base,
+                             s->chan_base ? ctx->nbBase * s->nb_channels : 0);
+    else if ((ret = export_buckets(s->analysis.fctx.filter_graph, &ctx->base, &ctx->nbBase,
+                                   &ctx->samplesPerBase, NULL, NULL)) >= 0)
+        ret = export_results(ctx, find_wf(s->analysis.fctx.filter_graph));
+end:
+    ret = join_stream(&s->analysis, ret);
+    add_stats(&ctx->stats, &s->analysis.stats);
+    free_rings(&s->analysis);
+    ret = close_outputs(ctx, ret);
+    ctx->nbAllocs = s->allocs;
+#ifdef WFG_DEBUG_ALLOCS
+    fprintf(stderr, "%s: %d frames and buffers allocated\n", infile, ctx->nbAllocs);
+#endif
+    if (ctx->nbBase && !ctx->cacheHit && nb_probes) {
+        /* only the probes were decoded, the estimate is all there is */
+        ctx->nbSamples = ctx->estimatedSamples;
+    } else if (ctx->nbBase && !ctx->cacheHit) {
+        for (i = 0; i < ctx->nbBase; i++)
+            ctx->nbSamples += ctx->base[i].nb;
+        ctx->duration = ctx->nbSamples * 1000 / ctx->sampleRate;
+        /* report estimates off by more than 1%, a stream has none */
+        if (!ctx->estimatedSamples && !ctx->liveMs)
+            fprintf(stderr, "%s: unknown duration, %"PRId64" samples decoded\n",
+                    infile, ctx->nbSamples);
+        else if (FFABS(ctx->estimatedSamples - ctx->nbSamples) * 100 > ctx->nbSamples)
+            fprintf(stderr, "%s: duration estimate off by %+.1f%%, %"PRId64" samples "
+                    "estimated, %"PRId64" decoded\n", infile,
+                    100.0 * (ctx->estimatedSamples - ctx->nbSamples) / ctx->nbSamples,
+                    ctx->estimatedSamples, ctx->nbSamples);
+    }
+    ret = wfg_liveClose(&s->live, ctx->nbSamples, ctx->sampleRate, ret);
+    av_freep(&s->chan_base);
+    /* hand the results to the sinks, from the cache too */
+    if (ret >= 0 && ctx->resultData)
+        ret = wfg_deliverResults(ctx);
+    if (ret >= 0 && ctx->cacheHit) {
+        /* found by its samples: by its bytes next time, the entry is as is */
+        if (nb_cache_keys > 1 &&
+            (i = wfg_cacheLink(ctx, cache_keys[1], cache_keys[0])) < 0)
+            fprintf(stderr, "%s: not cached: %s\n", infile, av_err2str(i));
+    } else if (ret >= 0 && nb_cache_keys) {
+        WfgOutput *outputs[WFG_MAX_OUTPUTS + 1];
+        const char *keys[2] = { cache_keys[0], cache_keys[1] };
+        int nb = run_outputs(ctx, outputs);
+        /* a failed store only costs the next run its hit */
+        if ((i = wfg_cacheStore(ctx, outputs, nb, keys, nb_cache_keys)) < 0)
+            fprintf(stderr, "%s: not cached: %s\n", infile, av_err2str(i));
+    }
+    av_freep(&s->run_spec);
+    av_free_packet(&packet);
+    av_frame_free(&frame);
+    
+    close_decoder(s->ifmt_ctx, s->stream_index);
+    free_filter(&s->analysis.fctx);
+    if (s->ifmt_ctx && s->ifmt_ctx->pb)
+        ctx->stats.bytesIn += avio_tell(s->ifmt_ctx->pb);
+    close_input_file(&s->ifmt_ctx);
+    ctx->stats.elapsed = (av_gettime_relative() - s->start_time) / 1e6;
+    ctx->stats.peakRssKb = peak_rss_kb();
+    
+    if (ret < 0) {
+        fprintf(stderr, "Error occurred: %s", av_err2str(ret));
+        emit_event(ctx, WFG_EVENT_ERROR, infile, ctx->stats.samplesDecoded, ret);
+    } else
+        emit_event(ctx, WFG_EVENT_FINISHED, infile, ctx->nbSamples, 0);
+    
+    return ret < 0 ? ret : 0;
+}
+
+/* a number of WfgLoudness, null for none (NAN, or the -inf dB of silence) */
+static void print_measure(FILE *out, const char *name, double value, int last)
+{
+    if (isfinite(value))
+        fprintf(out, "\"%s\":%.2f%s", name, value, last ? "" : ",");
+    else
+        fprintf(out, "\"%s\":null%s", name, last ? "" : ",");
+}
+
+int wfg_printJson(const WfgContext *ctx, int index, FILE *out)
+{
+    const WfgResult *r = &ctx->typedResults[index];
+    const WfgLoudness *l = &ctx->loudness;
+    char *levels, *channels = NULL;
+    int ret;
+    
+    /* formatted here, only when a document is written */
+    if (index >= ctx->nbTypedResults)
+        return AVERROR(EINVAL);
+    if (!(levels = wfg_levelsJson(r)) ||
+        (r->nbChannels && !(channels = wfg_channelsJson(r)))) {
+        av_free(levels);
+        return AVERROR(ENOMEM);
+    }
+    ret = fprintf(out, "{\"width\":%d,\"height\":%d,\"samples\":[%s]%s%s",
+                  r->width, r->height, levels, channels ? ",\"channels\":" : "",
+                  channels ? channels : "");
+    av_free(levels);
+    av_free(channels);
+    if (ret < 0)
+        return AVERROR(EIO);
+    if (ctx->hasLoudness) {
+        fprintf(out, ",\"loudness\":{");
+        print_measure(out, "integrated", l->integrated, 0);
+        print_measure(out, "true_peak", l->truePeak, 0);
+        print_measure(out, "sample_peak", l->samplePeak, 0);
+        fprintf(out, "\"replaygain\":{");
+        print_measure(out, "gain", l->replayGain, 0);
+        fprintf(out, "\"peak\":%.6f},\"silence\":{\"start\":%d,\"end\":%d}}",
+                l->replayGainPeak, l->silenceStart, l->silenceEnd);
+    }
+    return fprintf(out, "}") < 0 ? AVERROR(EIO) : 0;
+}
+
+int wfg_writeJson(const WfgContext *ctx, const char *infile)
+{
+    int i, ret = 0;
+    
+    if (ctx->jsonToStdout) {
+        /* one document per line, in the order of widths[] */
+        for (i = 0; i < ctx->nbTypedResults && ret >= 0; i++)
+            if ((ret = wfg_printJson(ctx, i, stdout)) >= 0)
+                ret = putchar('\n') == EOF ? AVERROR(EIO) : 0;
+        fflush(stdout);
+        return ret;
+    }
+    /* every width is written, the first error is returned */
+    for (i = 0; i < ctx->nbTypedResults; i++) {
+        char suffix[12], *jsonFileName;
+        FILE *jsonFile;
+        int err;
+        
+        if (i < 2)
+            strcpy(suffix, i ? "s" : "m");
+        else
+            sprintf(suffix, "%d", ctx->widths[i]);
+        if (!(jsonFileName = av_asprintf("%s_%s.json", infile, suffix)))
+            return AVERROR(ENOMEM);
+        jsonFile = fopen(jsonFileName, "w");
+        if (!jsonFile) {
+            err = AVERROR(errno);
+            fprintf(stderr, "Could not open '%s'\n", jsonFileName);
+        } else {
+            err = wfg_printJson(ctx, i, jsonFile);
+            if (fclose(jsonFile) && err >= 0)
+                err = AVERROR(errno);
+        }
+        av_free(jsonFileName);
+        if (err < 0 && ret >= 0)
+            ret = err;
+    }
+    return ret;
+}
+
+int wfg_printStats(const WfgContext *ctx, const char *event, const char *infile,
+                   FILE *out)
+{
+    return print_stats(&ctx->stats, event, infile, out);
+}
+
+int wfg_generateImage(WfgContext *ctx, char *infile, char *outfile)
+{
+    const char *name = ctx->name ? ctx->name : infile;
+    int64_t start = av_gettime_relative();
+    int ret = wfg_run(ctx, infile, outfile), timed = !!ctx->statsFile;
+    StageClock clock;
+    
+    /* whatever was analyzed before an error is still written */
+    stage_start(&clock, timed);
+    if (wfg_writeJson(ctx, name) < 0)
+        ret = -1;
+    if (!ret && ctx->nbImages && wfg_writeImages(ctx, name) < 0)
+        ret = -1;
+    if (!ret && ctx->binaryBits) {
+        char *path = av_asprintf("%s.wfb", name);
+        if (!path || wfg_writeBinary(ctx, path) < 0)
+            ret = -1;
+        av_free(path);
+    }
+    stage_end(&ctx->stats, WFG_STAGE_WRITE, &clock, timed);
+    if (timed) {
+        ctx->stats.elapsed = (av_gettime_relative() - start) / 1e6;
+        ctx->stats.peakRssKb = peak_rss_kb();
+        wfg_printStats(ctx, ret ? "failed" : "done", infile, ctx->statsFile);
+    }
+    return ret ? 1 : 0;
 }
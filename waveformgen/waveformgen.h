@@ -18,14 +18,320 @@
 */
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 
 #ifndef WAVEFORMGEN_H
 #define WAVEFORMGEN_H
 
 #define WAVEFORMGEN_VERSION "0.11"
 
-int width, widthSmall, height;
-int wfg_generateImage(char *infile, char *outfile);
+#define WFG_MAX_WIDTHS 8
+#define WFG_MAX_OUTPUTS 8
+#define WFG_MAX_IMAGES 8
+#define WFG_MAX_LIVE_LEVELS 16
+
+// per-channel metrics, see channelMetrics
+#define WFG_METRIC_MIN 1
+#define WFG_METRIC_MAX 2
+#define WFG_METRIC_RMS 4
+
+// one bucket of the base summary, mirrors WFBucket in af_wf.c
+typedef struct WFBucket {
+    double sum_sq;      // sum of squared levels, averaged over the channels
+    int64_t nb;         // samples per channel
+    float min, max;     // sample peaks, 0 if nb is 0
+} WFBucket;
+
+// add b to a; the peaks of empty buckets do not count
+void wfg_mergeBucket(WFBucket *a, const WFBucket *b);
+
+// one encoded rendition of the input; all of them are fed from one decode
+typedef struct WfgOutput {
+    // file, "-" for stdout, unused with toMemory
+    const char *path;
+    // container, guessed from path; mp3 when there is no file name
+    const char *format;
+    // encoder, the container's default when NULL
+    const char *codec;
+    // 0 keeps the encoder's default bit rate, the input's sample rate (or
+    // the closest one the encoder supports) and stereo
+    int bitRate, sampleRate, channels;
+    // keep the encoded audio in data instead of writing path
+    bool toMemory;
+    // the encoded audio of the last run with toMemory
+    uint8_t *data;
+    int size;
+    // its .idx seek index (wfi.h) with toMemory and seekIndex
+    uint8_t *index;
+    int indexSize;
+} WfgOutput;
+
+// a PNG of the levels of one of the widths, written as
+// <name>_<width>x<height>.png: bars centered on the middle row, each as tall
+// as its level scaled from the context's height to the image's
+typedef struct WfgImage {
+    int width, height;
+    // RGBA; the bars fade from top at the first row to bottom at the last.
+    // A background or bar alpha below 255 writes an RGBA image, else RGB
+    uint8_t top[4], bottom[4], background[4];
+    // the PNG encoder, kept open for the next runs; freed by wfg_free()
+    void *encoder;
+} WfgImage;
+
+// the stages a job's time is accounted to
+enum WfgStage {
+    WFG_STAGE_DEMUX,
+    WFG_STAGE_DECODE,
+    WFG_STAGE_ANALYZE,      // the wf filter, on its own thread
+    WFG_STAGE_WAIT,         // decoding held back by a full output or analysis queue
+    WFG_STAGE_RESAMPLE,     // conversion to each encoder's format
+    WFG_STAGE_ENCODE,
+    WFG_STAGE_MUX,
+    WFG_STAGE_WRITE,        // JSON and .wfb results
+    WFG_NB_STAGES
+};
+
+// seconds spent in one stage, summed over the threads that ran it
+typedef struct WfgStageTime {
+    double wall, cpu;
+} WfgStageTime;
+
+typedef struct WfgStats {
+    WfgStageTime stages[WFG_NB_STAGES];
+    // read from the input, and encoded audio written over all outputs
+    int64_t bytesIn, bytesOut;
+    // of the audio stream, samples per channel
+    int64_t packetsIn, framesDecoded, samplesDecoded;
+    // summed over the outputs
+    int64_t framesEncoded, packetsOut;
+    // wall time of the whole job
+    double elapsed;
+    // peak resident memory of the process so far
+    long peakRssKb;
+} WfgStats;
+
+// what a run reports while it goes, in this order: started, probed once the
+// input is open, progress while decoding, then finished or error
+typedef enum WfgEventType {
+    WFG_EVENT_STARTED,
+    WFG_EVENT_PROBED,
+    WFG_EVENT_PROGRESS,
+    WFG_EVENT_FINISHED,
+    WFG_EVENT_ERROR,
+} WfgEventType;
+
+typedef struct WfgEvent {
+    WfgEventType type;
+    const char *input;
+    // of the decoded samples per channel to the estimate, -1 when unknown
+    int percent;
+    // in ms, the estimate until finished (0 when unknown), then what was decoded
+    int duration;
+    int64_t samples;
+    int sampleRate;
+    // AVERROR code of an error event
+    int error;
+} WfgEvent;
+
+typedef void (*wfg_event_fn)(void *opaque, const WfgEvent *event);
+
+// what a run with measureLoudness measured of the whole input
+typedef struct WfgLoudness {
+    // EBU R128 integrated loudness in LUFS, NAN when no 400 ms block is
+    // above the gates (too short or silent)
+    double integrated;
+    // of the signal oversampled 4 times and of the samples, in dBFS
+    double truePeak, samplePeak;
+    // ReplayGain 2.0: the gain to -18 LUFS in dB, NAN with integrated, and
+    // the peak to go with it, the linear true peak
+    double replayGain, replayGainPeak;
+    // ms of the first sample above silenceThreshold and after the last one,
+    // both 0 when there is none
+    int silenceStart, silenceEnd;
+} WfgLoudness;
+
+// the results of one width, as the sinks get them once a run is done
+typedef struct WfgResult {
+    int index;              // in widths[]
+    int width, height;
+    // width levels in [0, height]
+    const int32_t *levels;
+    // with channelMetrics, the arrays of the metrics asked for, NULL for the
+    // others: width values of channel 0, those of channel c channelStride
+    // values further. Peaks in [-height, height], rms in [0, height]
+    int nbChannels, channelStride;
+    const int32_t *min, *max, *rms;
+    // of the whole input
+    int64_t samples;
+    int sampleRate, duration;
+    // with measureLoudness, NULL otherwise
+    const WfgLoudness *loudness;
+} WfgResult;
+
+// called for each width in the order of widths[]; a negative return fails
+// the run. The arrays are valid until the next run
+typedef int (*wfg_result_fn)(void *opaque, const WfgResult *result);
+
+// One job's configuration, state and results. A context is used by one
+// thread at a time; separate contexts can run concurrently.
+typedef struct WfgContext {
+    // configuration, set before wfg_run(); wfg_create() sets the defaults
+    // widths[0] goes to <infile>_m.json, widths[1] to <infile>_s.json and any
+    // further width to <infile>_<width>.json; all are reduced from one pass.
+    int widths[WFG_MAX_WIDTHS], nbWidths, height;
+    // WFG_METRIC_* flags: also compute the signed min, max and RMS of each
+    // channel per output bucket, in the same pass over the samples
+    int channelMetrics;
+    // also measure the integrated loudness, the true and sample peak and the
+    // silence at both ends in the same pass, see loudness; the input is
+    // then decoded whole and in order (no nbSegments or approximate)
+    bool measureLoudness;
+    // level in dBFS the silence ends at, -60 by default
+    double silenceThreshold;
+    // number of time ranges decoded in parallel, waveform-only runs (no -o)
+    // of an input whose seeking is sample exact; MP3 and ADTS inputs, whose
+    // timestamps after a seek are estimates, are decoded sequentially
+    int nbSegments;
+    // waveform-only runs of a seekable input: decode about this fraction of
+    // it, in short probes spread evenly over it, instead of all of it; 0
+    // decodes everything. Each column of the widest width gets a probe, so
+    // a level is the RMS of the probes within the column rather than of all
+    // its samples. Inputs too short to gain from it are decoded whole, the
+    // duration is then the container's estimate
+    double approximate;
+    // live mode for streams of no known length, 0 for none: buckets of this
+    // many ms instead of a fixed width, appended to <name>_live.jsonl in
+    // chunks of liveChunk ms as they are decoded, along with liveLevels - 1
+    // coarser levels pairing them up. The widths, images and .wfb file are
+    // still written at the end, from a summary coarsened to stay bounded.
+    // Not cached, not split or approximated. See wfg_setLive()
+    int liveMs, liveChunk, liveLevels;
+    // called with the events of a run on the thread running it, between
+    // two packets: it should hand them off rather than wait on anything
+    wfg_event_fn onEvent;
+    void *eventOpaque;
+    // ms between two progress events, 1000 by default; those in between and
+    // those with an unchanged percent are dropped
+    int progressInterval;
+    // called with the results of every width after a run, NULL for none.
+    // No text is formatted for them: the JSON files are written from the
+    // typed results when asked for, wfg_jsonSink() keeps it in results[]
+    wfg_result_fn onResult;
+    void *resultOpaque;
+    // also write <infile>.wfb with 8 or 16 bit values, 0 for none
+    int binaryBits;
+    // samples per bucket of the finest .wfb level, 0 for the base resolution
+    int zoomSamples;
+    // names the result files instead of the input path, needed for stdin
+    const char *name;
+    // print the JSON documents to stdout, one per line, instead of files
+    bool jsonToStdout;
+    // collect stats and append one JSON record per job to statsFile, plus
+    // a "progress" one every statsInterval seconds when not 0
+    FILE *statsFile;
+    int statsInterval;
+    // reuse the results of a run with the same input and parameters from
+    // this directory, and store new ones there; NULL for no cache. Inputs
+    // are keyed by their bytes, and with cacheByAudio also by their decoded
+    // samples so the same audio in another container hits; that costs a
+    // decode of the input ahead of a run missing the cache
+    const char *cacheDir;
+    bool cacheByAudio;
+    // PNGs drawn from the results after each run, see wfg_addImage()
+    WfgImage images[WFG_MAX_IMAGES];
+    int nbImages;
+    // renditions encoded on their own threads, see wfg_addOutput()
+    WfgOutput outputs[WFG_MAX_OUTPUTS];
+    int nbOutputs;
+    // record the timestamp and byte offset of every packet muxed and write
+    // them as <path>.idx beside each output, not for stdout
+    bool seekIndex;
+    
+    // results of the last wfg_run(), one per width, laid over resultData:
+    // the int32 levels of each width followed by its channel arrays
+    WfgResult typedResults[WFG_MAX_WIDTHS];
+    int nbTypedResults;
+    int32_t *resultData;
+    int resultSize;     // in bytes
+    // with onResult = wfg_jsonSink, their JSON serialization: comma
+    // separated levels for each width
+    char *results[WFG_MAX_WIDTHS];
+    int nbResults;
+    // with channelMetrics, per width a JSON array of one object per channel
+    // holding the "min", "max" and "rms" arrays asked for
+    char *channelResults[WFG_MAX_WIDTHS];
+    int nbChannelResults;
+    // with measureLoudness, what was measured
+    WfgLoudness loudness;
+    bool hasLoudness;
+    // duration of the input in ms, of what was decoded once the run is done
+    int duration;
+    // samples per channel decoded, and the container's estimate (0 when
+    // unknown) the base was sized from; the widths only depend on the first
+    int64_t nbSamples, estimatedSamples;
+    // the base summary all widths were reduced from
+    WFBucket *base;
+    int nbBase, samplesPerBase, sampleRate;
+    // AVFrames and packet buffers the frame loop allocated; they are reused
+    // once in circulation, so this does not grow with the input length.
+    // It does not count FFmpeg's own allocations, and those are not zero
+    // per frame: every reference to a frame, including those the decoder's
+    // and the filters' buffer pools hand out, allocates its small AVBuffer
+    // structs. Built with -DWFG_DEBUG_ALLOCS every heap allocation of the
+    // process is counted, and their number per frame after a warm-up is
+    // reported on stderr along with this
+    int nbAllocs;
+    // the last run's results came from cacheDir
+    bool cacheHit;
+    // with statsFile, of the last run and its results written
+    WfgStats stats;
+    
+    struct WfgInternal *internal;
+} WfgContext;
+
+WfgContext *wfg_create(void);
+// set the configuration of dst to src's as a whole, for another thread to
+// run with; dst keeps its own state and image encoders and has no results.
+// The output paths stay src's, which must outlive dst's runs
+void wfg_copyConfig(WfgContext *dst, const WfgContext *src);
+// add an output given as "[key=value:...]path": f container, c encoder,
+// b bit rate (k and M suffixes), ar sample rate, ac channels
+int wfg_addOutput(WfgContext *ctx, const char *spec);
+// add an image given as "[key=value:...]<width>x<height>": fg the color of
+// the bars, fg2 the one they fade to at the bottom, bg the background, each
+// RRGGBB or RRGGBBAA. Default: black bars on white
+int wfg_addImage(WfgContext *ctx, const char *spec);
+// turn live mode on as "[key=value:...]<ms>": c ms per chunk (Default: 1000),
+// l levels (Default: 8)
+int wfg_setLive(WfgContext *ctx, const char *spec);
+// infile "-" reads stdin; local files are mapped, pipes read as they fill.
+// outfile is one more output spec for this run only, NULL for none; with
+// no output at all only the waveform is computed
+int wfg_run(WfgContext *ctx, const char *infile, const char *outfile);
+// write the results of the last run next to infile, or to stdout
+int wfg_writeJson(const WfgContext *ctx, const char *infile);
+int wfg_printJson(const WfgContext *ctx, int index, FILE *out);
+// draw an image of the last run into rgba, linesize bytes per row (at least
+// 4 * width, a multiple of 4); its width must be one of the widths
+int wfg_renderImage(const WfgContext *ctx, const WfgImage *image, uint8_t *rgba,
+                    int linesize);
+// draw every image of the last run and write it as a PNG named after name
+int wfg_writeImages(WfgContext *ctx, const char *name);
+// write the base summary of the last run as a multi-level .wfb file
+int wfg_writeBinary(const WfgContext *ctx, const char *path);
+// print the stats of the last job as one JSON line, event naming it
+int wfg_printStats(const WfgContext *ctx, const char *event, const char *infile,
+                   FILE *out);
+void wfg_free(WfgContext **ctx);
+// format an event as one JSON line into buf, returns its length or a
+// negative value when it does not fit
+int wfg_formatEvent(const WfgEvent *event, char *buf, int size);
+// a sink producing results[] and channelResults[] of the context opaque
+int wfg_jsonSink(void *opaque, const WfgResult *result);
+
+// run, then write the JSON files, images and the stats record
+int wfg_generateImage(WfgContext *ctx, char *infile, char *outfile);
 char* wfg_lastErrorMessage();
 int wfg_Seconds();
 
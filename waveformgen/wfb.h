@@ -0,0 +1,58 @@
+/*
+ wfb.h
+
+ This file is part of waveformgen.
+ 
+ waveformgen is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ waveformgen is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with waveformgen. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef WFG_WFB_H
+#define WFG_WFB_H
+
+#include <stdint.h>
+
+// The .wfb waveform file, little-endian throughout:
+//
+//   WfbHeader
+//   WfbLevel[nbLevels]      where each level's records start
+//   records of level 0, 1, ... each starting on an 8 byte boundary
+//
+// Level k has one record per samplesPerBucket << k samples (per channel),
+// the last one possibly shorter; each level halves the one before until a
+// single record is left. A record is min, max and rms, each bytesPerValue
+// bytes signed: min and max are the sample peaks and rms the RMS of the
+// level the JSON output is drawn from, with full scale at 127 or 32767.
+
+#define WFB_MAGIC "WFB1"
+#define WFB_VERSION 1
+#define WFB_MAX_LEVELS 48
+
+typedef struct WfbHeader {
+    char magic[4];
+    uint8_t version;
+    uint8_t bytesPerValue;  // 1 or 2
+    uint16_t nbLevels;
+    uint32_t sampleRate;
+    uint32_t samplesPerBucket;  // of level 0
+    uint64_t nbSamples;         // per channel
+    uint32_t reserved[2];
+} WfbHeader;
+
+typedef struct WfbLevel {
+    uint64_t offset;        // of the first record, from the start of the file
+    uint64_t nbBuckets;
+} WfbLevel;
+
+#endif
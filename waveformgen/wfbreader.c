@@ -0,0 +1,159 @@
+/*
+ wfbreader.c
+
+ This file is part of waveformgen.
+ 
+ waveformgen is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ waveformgen is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with waveformgen. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "wfb.h"
+#include "wfbreader.h"
+
+static uint64_t rl(const uint8_t *p, int bytes)
+{
+    uint64_t v = 0;
+    
+    while (bytes--)
+        v = v << 8 | p[bytes];
+    return v;
+}
+
+static const uint8_t *levelEntry(const WfbReader *r, int level)
+{
+    return r->data + sizeof(WfbHeader) + level * sizeof(WfbLevel);
+}
+
+int wfb_openMemory(WfbReader *r, const void *data, size_t size)
+{
+    const uint8_t *p = data;
+    int i;
+    
+    memset(r, 0, sizeof(*r));
+    if (size < sizeof(WfbHeader) || memcmp(p, WFB_MAGIC, 4) || p[4] != WFB_VERSION)
+        return -EINVAL;
+    r->data = p;
+    r->size = size;
+    r->bytesPerValue = p[5];
+    r->nbLevels = rl(p + 6, 2);
+    r->sampleRate = rl(p + 8, 4);
+    r->samplesPerBucket = rl(p + 12, 4);
+    r->nbSamples = rl(p + 16, 8);
+    if ((r->bytesPerValue != 1 && r->bytesPerValue != 2) || !r->samplesPerBucket ||
+        r->nbLevels < 1 || r->nbLevels > WFB_MAX_LEVELS ||
+        size < sizeof(WfbHeader) + r->nbLevels * sizeof(WfbLevel))
+        return -EINVAL;
+    r->maxValue = r->bytesPerValue == 1 ? INT8_MAX : INT16_MAX;
+    
+    // every level must lie within the file
+    for (i = 0; i < r->nbLevels; i++) {
+        uint64_t offset = rl(levelEntry(r, i), 8), nb = rl(levelEntry(r, i) + 8, 8);
+        if (offset > size || nb > (size - offset) / (3 * r->bytesPerValue))
+            return -EINVAL;
+    }
+    return 0;
+}
+
+int wfb_open(WfbReader *r, const char *path)
+{
+    struct stat st;
+    void *data;
+    int fd, ret;
+    
+    memset(r, 0, sizeof(*r));
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return -errno;
+    if (fstat(fd, &st) < 0) {
+        ret = -errno;
+        close(fd);
+        return ret;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ret = data == MAP_FAILED ? -errno : 0;
+    close(fd);
+    if (ret < 0)
+        return ret;
+    if ((ret = wfb_openMemory(r, data, st.st_size)) < 0) {
+        munmap(data, st.st_size);
+        return ret;
+    }
+    r->mapped = 1;
+    return 0;
+}
+
+void wfb_close(WfbReader *r)
+{
+    if (r->mapped)
+        munmap((void *)r->data, r->size);
+    memset(r, 0, sizeof(*r));
+}
+
+int64_t wfb_nbBuckets(const WfbReader *r, int level)
+{
+    if (level < 0 || level >= r->nbLevels)
+        return 0;
+    return rl(levelEntry(r, level) + 8, 8);
+}
+
+uint64_t wfb_bucketSamples(const WfbReader *r, int level)
+{
+    return (uint64_t)r->samplesPerBucket << level;
+}
+
+int wfb_pickLevel(const WfbReader *r, uint64_t startSample, uint64_t endSample, int width)
+{
+    int level;
+    
+    for (level = r->nbLevels - 1; level > 0; level--)
+        if ((endSample - startSample) / wfb_bucketSamples(r, level) >= (uint64_t)width)
+            break;
+    return level;
+}
+
+const void *wfb_records(const WfbReader *r, int level)
+{
+    if (level < 0 || level >= r->nbLevels)
+        return NULL;
+    return r->data + rl(levelEntry(r, level), 8);
+}
+
+int wfb_read(const WfbReader *r, int level, int64_t first, int nb, WfbValue *values)
+{
+    const uint8_t *p = wfb_records(r, level);
+    int64_t total = wfb_nbBuckets(r, level);
+    int bytes = r->bytesPerValue, i;
+    
+    if (!p || first < 0 || first >= total)
+        return 0;
+    if (nb > total - first)
+        nb = total - first;
+    p += first * 3 * bytes;
+    for (i = 0; i < nb; i++, p += 3 * bytes) {
+        if (bytes == 1) {
+            values[i].min = (int8_t)p[0];
+            values[i].max = (int8_t)p[1];
+            values[i].rms = (int8_t)p[2];
+        } else {
+            values[i].min = (int16_t)rl(p, 2);
+            values[i].max = (int16_t)rl(p + 2, 2);
+            values[i].rms = (int16_t)rl(p + 4, 2);
+        }
+    }
+    return nb;
+}
@@ -0,0 +1,60 @@
+/*
+ wfbreader.h
+
+ This file is part of waveformgen.
+ 
+ waveformgen is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ waveformgen is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with waveformgen. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef WFG_WFBREADER_H
+#define WFG_WFBREADER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Reads .wfb files (see wfb.h) without parsing: the file is mapped and
+// records are decoded only for the range asked for. Needs no ffmpeg.
+
+typedef struct WfbReader {
+    const uint8_t *data;
+    size_t size;
+    int mapped;
+    int bytesPerValue;
+    int maxValue;               // full scale, 127 or 32767
+    int nbLevels;
+    unsigned sampleRate;
+    unsigned samplesPerBucket;  // of level 0
+    uint64_t nbSamples;
+} WfbReader;
+
+typedef struct WfbValue {
+    int min, max, rms;          // in [-maxValue, maxValue]
+} WfbValue;
+
+// map path, or use size bytes at data kept valid by the caller; 0 or -errno
+int wfb_open(WfbReader *r, const char *path);
+int wfb_openMemory(WfbReader *r, const void *data, size_t size);
+void wfb_close(WfbReader *r);
+
+int64_t wfb_nbBuckets(const WfbReader *r, int level);
+uint64_t wfb_bucketSamples(const WfbReader *r, int level);
+// the coarsest level with at least width buckets for [startSample, endSample)
+int wfb_pickLevel(const WfbReader *r, uint64_t startSample, uint64_t endSample, int width);
+// decode the records [first, first + nb) of a level, returns how many
+int wfb_read(const WfbReader *r, int level, int64_t first, int nb, WfbValue *values);
+// the raw little-endian records of a level, 3 * bytesPerValue bytes each
+const void *wfb_records(const WfbReader *r, int level);
+
+#endif
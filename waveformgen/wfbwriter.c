@@ -0,0 +1,121 @@
+/*
+ wfbwriter.c
+
+ This file is part of waveformgen.
+ 
+ waveformgen is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ waveformgen is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with waveformgen. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <math.h>
+#include "libavutil/common.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/mem.h"
+#include "waveformgen.h"
+#include "wfb.h"
+
+static int quantize(double x, int scale)
+{
+    return (int)lrint(av_clipd(x, -1.0, 1.0) * scale);
+}
+
+static uint8_t *writeRecords(uint8_t *p, const WFBucket *b, int nb, int bytesPerValue)
+{
+    int scale = bytesPerValue == 1 ? INT8_MAX : INT16_MAX;
+    int i, v[3], k;
+    
+    for (i = 0; i < nb; i++) {
+        v[0] = quantize(b[i].min, scale);
+        v[1] = quantize(b[i].max, scale);
+        v[2] = quantize(b[i].nb ? sqrt(b[i].sum_sq / b[i].nb) : 0, scale);
+        for (k = 0; k < 3; k++) {
+            if (bytesPerValue == 1) {
+                *p++ = (uint8_t)v[k];
+            } else {
+                AV_WL16(p, v[k]);
+                p += 2;
+            }
+        }
+    }
+    return p;
+}
+
+int wfg_writeBinary(const WfgContext *ctx, const char *path)
+{
+    int bytesPerValue = ctx->binaryBits == 16 ? 2 : 1;
+    int recordSize = 3 * bytesPerValue;
+    int64_t nbBuckets[WFB_MAX_LEVELS], offset;
+    WFBucket *level = NULL;
+    uint8_t *data = NULL, *p;
+    int nbLevels = 0, nb, i, ret = 0;
+    FILE *file;
+    
+    if (!ctx->nbBase)
+        return AVERROR(EINVAL);
+    
+    // halve until one bucket is left
+    offset = sizeof(WfbHeader);
+    for (nb = ctx->nbBase; nbLevels < WFB_MAX_LEVELS; nb = (nb + 1) / 2) {
+        nbBuckets[nbLevels++] = nb;
+        offset += sizeof(WfbLevel) + FFALIGN(nb * recordSize, 8);
+        if (nb == 1)
+            break;
+    }
+    level = av_memdup(ctx->base, ctx->nbBase * sizeof(*level));
+    data = av_mallocz(offset);
+    if (!level || !data) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    
+    memcpy(data, WFB_MAGIC, 4);
+    data[4] = WFB_VERSION;
+    data[5] = bytesPerValue;
+    AV_WL16(data + 6, nbLevels);
+    AV_WL32(data + 8, ctx->sampleRate);
+    AV_WL32(data + 12, ctx->samplesPerBase);
+    AV_WL64(data + 16, ctx->nbSamples);
+    
+    offset = sizeof(WfbHeader) + nbLevels * sizeof(WfbLevel);
+    for (i = 0; i < nbLevels; i++) {
+        p = data + sizeof(WfbHeader) + i * sizeof(WfbLevel);
+        AV_WL64(p, offset);
+        AV_WL64(p + 8, nbBuckets[i]);
+        writeRecords(data + offset, level, nbBuckets[i], bytesPerValue);
+        offset += FFALIGN(nbBuckets[i] * recordSize, 8);
+        
+        // pairs of this level make the next one
+        for (nb = 0; 2 * nb < nbBuckets[i]; nb++) {
+            level[nb] = level[2 * nb];
+            if (2 * nb + 1 < nbBuckets[i])
+                wfg_mergeBucket(&level[nb], &level[2 * nb + 1]);
+        }
+    }
+    
+    file = fopen(path, "wb");
+    if (!file) {
+        ret = AVERROR(errno);
+        fprintf(stderr, "Could not open '%s'\n", path);
+        goto end;
+    }
+    if (fwrite(data, 1, offset, file) != offset)
+        ret = AVERROR(EIO);
+    if (fclose(file) && !ret)
+        ret = AVERROR(errno);
+end:
+    av_free(level);
+    av_free(data);
+    return ret;
+}
@@ -0,0 +1,61 @@
+/*
+ wfi.h
+
+ This file is part of waveformgen.
+ 
+ waveformgen is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ waveformgen is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with waveformgen. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef WFG_WFI_H
+#define WFG_WFI_H
+
+#include <stdint.h>
+
+// The .idx seek index of an encoded output, little-endian throughout:
+//
+//   WfiHeader
+//   WfiFrame[nbFrames]      one per packet, in the order they were muxed
+//
+// Timestamps are in samples of the output, the first one negative when the
+// encoder primes its first frame. A packet's offset is where the muxer
+// started writing it: exact for muxers that write each packet as it comes
+// (mp3, adts, wav, the mdat of mp4), at or before it for those that gather
+// packets into pages (ogg). A seek to t reads from the last frame with
+// pts <= t, skipping t - pts decoded samples.
+
+#define WFI_MAGIC "WFI1"
+#define WFI_VERSION 1
+#define WFI_TOC_SIZE 100
+
+typedef struct WfiHeader {
+    char magic[4];
+    uint8_t version;
+    uint8_t reserved0[3];
+    uint32_t sampleRate;        // of the timestamps
+    uint32_t nbFrames;
+    int64_t endPts;             // where the last packet ends
+    uint64_t dataEnd;           // bytes up to the end of the last packet
+    // a Xing TOC: entry i is the offset of i% of the duration in 1/256 of
+    // the bytes from the first packet to dataEnd
+    uint8_t toc[WFI_TOC_SIZE];
+    uint32_t reserved[1];
+} WfiHeader;
+
+typedef struct WfiFrame {
+    int64_t pts;
+    uint64_t offset;            // from the start of the file
+} WfiFrame;
+
+#endif
@@ -2,7 +2,7 @@
 
 import os, logging.handlers
 import boto.sqs as sqs
-import time, subprocess, json, threading
+import time, subprocess, json, threading, socket
 import boto.s3 as s3
 from boto.sqs.message import RawMessage
 from boto.s3.key import Key
@@ -18,6 +18,14 @@ WIDTH_SMALL = 800
 QUEUE_NAME = ''
 IN_BUCKET_NAME = ''
 OUT_BUCKET_NAME = ''
+# Unix socket of a running 'wf -S <socket>', empty to spawn wf per job
+SERVER_SOCKET = ''
+# pipe the S3 object into wf instead of downloading it first
+STREAM_INPUT = False
+# take the JSON results from wf's output and upload them from memory
+RESULTS_IN_MEMORY = False
+# ms between two progress messages sent to the job's queue
+PROGRESS_INTERVAL = 2000
 
 logger = logging.getLogger(__name__)
 logger.setLevel(logging.DEBUG)
@@ -76,6 +84,7 @@ class WfThread(threading.Thread):
         self.__outFile = key + '.mp3'
         self.__sJsonFile = key + '_s.json'
         self.__mJsonFile = key + '_m.json'
+        self.__results = []
         lock.acquire()
         count += 1
         lock.release()
@@ -87,48 +96,112 @@ class WfThread(threading.Thread):
         count -= 1
         lock.release()
         for fileName in [self.__sJsonFile, self.__mJsonFile, self.__key, self.__outFile]:
-            os.remove(WORK_DIR + fileName)
+            if os.path.exists(WORK_DIR + fileName):
+                os.remove(WORK_DIR + fileName)
         logger.debug('Destruct %s', self.__key)
 
     def _set_daemon(self):
         return True
 
     def run(self):
-        for fn in [self.__download, self.__process, self.__upload]:
+        steps = [self.__process, self.__upload] if STREAM_INPUT else [self.__download, self.__process, self.__upload]
+        for fn in steps:
             if not fn():
                 self.__enqueue('{"key": "error"}')
                 break
 
     def __process(self):
         logger.debug('Processing')
-        process = subprocess.Popen([
-            'wf',
-            '-i', WORK_DIR + self.__key,
+        args = [
+            '-i', '-' if STREAM_INPUT else WORK_DIR + self.__key,
+            '-n', WORK_DIR + self.__key,
             '-o', WORK_DIR + self.__outFile,
             '-h', str(HEIGHT),
             '-W', str(WIDTH),
-            '-w', str(WIDTH_SMALL)
-        ], stdout=subprocess.PIPE, stderr=subprocess.PIPE, bufsize=1)
-        while True:
-            output = process.stdout.readline()
-
-            if output == '' and process.poll() is not None:
-                break
-
-            if output:
-                output = int(output.strip())
-
-                if 100 < output:
-                    type = 'duration'
-                else:
-                    type = 'percent'
-                logger.debug('Reading output: %s - %d', type, output)
-                self.__enqueue('{"type": "%(key)s", "value": "%(value)s"}' % {'key': type, 'value': output})
-
-        rc = process.poll()
+            '-w', str(WIDTH_SMALL),
+            # typed events on stdout, next to the results of -s
+            '-p', '1',
+            '-R', str(PROGRESS_INTERVAL)
+        ]
+        if RESULTS_IN_MEMORY:
+            args.append('-s')
+        if SERVER_SOCKET and not STREAM_INPUT:
+            rc = self.__processOnServer(args)
+        else:
+            process = subprocess.Popen(['wf'] + args, stdout=subprocess.PIPE, stderr=subprocess.PIPE, bufsize=1,
+                                       stdin=subprocess.PIPE if STREAM_INPUT else None)
+            if STREAM_INPUT:
+                feeder = threading.Thread(target=self.__feed, args=(process.stdin,))
+                feeder.start()
+            while True:
+                output = process.stdout.readline()
+
+                if output == '' and process.poll() is not None:
+                    break
+
+                if output:
+                    self.__handle(output)
+
+            rc = process.poll()
+            if STREAM_INPUT:
+                feeder.join()
         logger.debug('RC: %d', rc)
         return 0 == rc
 
+    def __feed(self, pipe):
+        # wf decodes while the object is still downloading
+        try:
+            obj = self.S3Conn.get_bucket(IN_BUCKET_NAME).get_key(self.__key)
+            if None == obj:
+                logger.debug('No key to stream %s', self.__key)
+            else:
+                obj.get_contents_to_file(pipe)
+        except Exception as e:
+            logger.debug('Streaming failed %s', str(e))
+        finally:
+            pipe.close()
+
+    def __processOnServer(self, args):
+        s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        try:
+            s.connect(SERVER_SOCKET)
+            s.sendall('\t'.join(args) + '\n')
+            f = s.makefile('r')
+            for output in f:
+                if output.startswith('exit '):
+                    return int(output[5:])
+                self.__handle(output)
+        except socket.error as e:
+            logger.debug('Server failed: %s', str(e))
+        finally:
+            s.close()
+        return -1
+
+    def __handle(self, output):
+        # events and the JSON documents (one per line, main width first) share the output
+        if not output.startswith('{'):
+            return
+        if not output.startswith('{"event"'):
+            self.__results.append(output.strip())
+            return
+        try:
+            self.__report(json.loads(output))
+        except ValueError:
+            logger.warning('Unable to decode event %s', output)
+
+    def __report(self, event):
+        if event['event'] == 'progress' and event['percent'] is not None:
+            type, value = 'percent', event['percent']
+        elif event['event'] == 'finished':
+            type, value = 'duration', event['duration']
+        elif event['event'] == 'error':
+            logger.debug('wf failed: %s', event['message'])
+            return
+        else:
+            return
+        logger.debug('Reading output: %s - %d', type, value)
+        self.__enqueue('{"type": "%(key)s", "value": "%(value)s"}' % {'key': type, 'value': value})
+
     def __enqueue(self, msg):
         m = RawMessage()
         m.set_body(msg)
@@ -149,11 +222,15 @@ class WfThread(threading.Thread):
         return True
 
     def __upload(self):
+        inMemory = dict(zip([self.__mJsonFile, self.__sJsonFile], self.__results))
         for fileName in [self.__sJsonFile, self.__mJsonFile, self.__outFile]:
             bucket = self.S3Conn.get_bucket(OUT_BUCKET_NAME)
             k = Key(bucket, fileName)
             try:
-                k.set_contents_from_filename(WORK_DIR + fileName)
+                if fileName in inMemory:
+                    k.set_contents_from_string(inMemory[fileName])
+                else:
+                    k.set_contents_from_filename(WORK_DIR + fileName)
                 k.set_acl('public-read')
             except Exception as e:
                 logger.debug('Upload failed: %s', str(e))